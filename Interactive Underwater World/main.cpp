@@ -1,1165 +1,5981 @@
-#include <GL/gl.h>
-#include <GL/glu.h>
-#include <GL/glut.h>
-#include <cmath>
-#include <vector>
-#include <ctime>
-#include <cstdlib>
-#include <algorithm>
-#include <iostream>
-
-void initialize();
-
-// Global variables to store current window size
-int windowWidth = 900;
-int windowHeight = 600;
-bool isFullScreen = false;
-
-struct Fish {
-    float x, y, speed, angle, scale;
-    float r, g, b;
-    bool facingRight;
-};
-
-struct Shark {
-    float x, y, speed, angle, scale;
-    float r, g, b;
-    bool facingRight;
-    float hunger;
-    enum class State { Idle, Patrol, Chase, Rest };
-    State state;
-    float stateTimer;
-};
-
-struct Bubble {
-    float x, y;
-    float radius;
-};
-
-struct Food {
-    float x, y;
-    float life;
-};
-
-struct Rock {
-    float x, scale;
-    float r, g, b;
-};
-
-struct Seaweed {
-    float x, height;
-    float green;
-};
-
-struct Ripple {
-    float x, y;
-    float radius;
-    float life;
-};
-
-struct Crab {
-    float x, y;
-    float speed;
-    float scale;
-    float r, g, b;
-    bool facingRight;
-};
-
-std::vector<Fish> fishList;
-std::vector<Shark> sharkList;
-std::vector<Bubble> bubbles;
-std::vector<Food> foodList;
-std::vector<Rock> rocks;
-std::vector<Seaweed> seaweeds;
-std::vector<Ripple> ripples;
-std::vector<Crab> crabs;
-GLuint fishDisplayList = 0, sharkDisplayList = 0, pebbleDisplayList = 0, seaweedDisplayList = 0;
-bool usePerspective = false;
-
-void checkGLError(const char* operation) {
-    GLenum error = glGetError();
-    if (error != GL_NO_ERROR) {
-        std::cerr << "OpenGL Error after " << operation << ": " << gluErrorString(error) << std::endl;
-    }
-}
-
-void initGL() {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(-1.0, 1.0, -1.0, 1.0, -1.0, 10.0);
-    glMatrixMode(GL_MODELVIEW);
-
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_LIGHT1);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL); // Use LEQUAL to handle depth precision
-    glEnable(GL_NORMALIZE);
-    glShadeModel(GL_SMOOTH);
-
-    GLfloat lightPos[] = {0.0f, 0.0f, 1.0f, 0.0f};
-    GLfloat ambient[] = {0.3f, 0.3f, 0.4f, 1.0f};
-    GLfloat diffuse[] = {0.7f, 0.7f, 0.8f, 1.0f};
-    GLfloat specular[] = {0.5f, 0.5f, 0.6f, 1.0f};
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-    glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, specular);
-
-    GLfloat light1Pos[] = {0.0f, -0.5f, 0.5f, 0.0f};
-    GLfloat light1Ambient[] = {0.1f, 0.2f, 0.3f, 1.0f};
-    GLfloat light1Diffuse[] = {0.2f, 0.3f, 0.4f, 1.0f};
-    glLightfv(GL_LIGHT1, GL_POSITION, light1Pos);
-    glLightfv(GL_LIGHT1, GL_AMBIENT, light1Ambient);
-    glLightfv(GL_LIGHT1, GL_DIFFUSE, light1Diffuse);
-    glLightfv(GL_LIGHT1, GL_SPECULAR, specular);
-
-    checkGLError("initGL");
-}
-
-void reshape(int width, int height) {
-    windowWidth = width;
-    windowHeight = height > 0 ? height : 1;
-    glViewport(0, 0, windowWidth, windowHeight);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    if (usePerspective) {
-        gluPerspective(60.0, (float)windowWidth / windowHeight, 0.1, 10.0);
-        glTranslatef(0.0f, 0.0f, -2.0f);
-    } else {
-        glOrtho(-1.0, 1.0, -1.0, 1.0, -1.0, 10.0);
-    }
-    glMatrixMode(GL_MODELVIEW);
-    checkGLError("reshape");
-}
-
-void initDisplayLists() {
-    fishDisplayList = glGenLists(1);
-    glNewList(fishDisplayList, GL_COMPILE);
-    glBegin(GL_QUADS);
-    for (int i = 0; i < 20; ++i) {
-        for (int j = 0; j < 20; ++j) {
-            float theta = i * 3.1416f / 20;
-            float phi = j * 2 * 3.1416f / 20;
-            float thetaNext = (i + 1) * 3.1416f / 20;
-            float phiNext = (j + 1) * 2 * 3.1416f / 20;
-            float x0 = cosf(phi) * sinf(theta);
-            float y0 = cosf(theta);
-            float z0 = sinf(phi) * sinf(theta);
-            float x1 = cosf(phiNext) * sinf(theta);
-            float y1 = cosf(theta);
-            float z1 = sinf(phiNext) * sinf(theta);
-            float x2 = cosf(phiNext) * sinf(thetaNext);
-            float y2 = cosf(thetaNext);
-            float z2 = sinf(phiNext) * sinf(thetaNext);
-            float x3 = cosf(phi) * sinf(thetaNext);
-            float y3 = cosf(thetaNext);
-            float z3 = sinf(phi) * sinf(thetaNext);
-            glNormal3f(x0, y0, z0);
-            glVertex3f(x0, y0, z0);
-            glNormal3f(x1, y1, z1);
-            glVertex3f(x1, y1, z1);
-            glNormal3f(x2, y2, z2);
-            glVertex3f(x2, y2, z2);
-            glNormal3f(x3, y3, z3);
-            glVertex3f(x3, y3, z3);
-        }
-    }
-    glEnd();
-    glEndList();
-    checkGLError("fishDisplayList");
-
-    sharkDisplayList = glGenLists(1);
-    glNewList(sharkDisplayList, GL_COMPILE);
-    glBegin(GL_QUADS);
-    for (int i = 0; i < 30; ++i) {
-        float t = i / 30.0f;
-        float tNext = (i + 1) / 30.0f;
-        float yScale = (t < 0.2f) ? (0.1f + 0.5f * t) : (0.2f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
-        float zScale = (t < 0.2f) ? (0.08f + 0.35f * t) : (0.15f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
-        for (int j = 0; j < 20; ++j) {
-            float phi = j * 2 * 3.1416f / 20;
-            float phiNext = (j + 1) * 2 * 3.1416f / 20;
-            float x0 = -0.5f + t * 0.9f;
-            float y0 = yScale * cosf(phi);
-            float z0 = zScale * sinf(phi);
-            float x1 = -0.5f + t * 0.9f;
-            float y1 = yScale * cosf(phiNext);
-            float z1 = zScale * sinf(phiNext);
-            float x2 = -0.5f + tNext * 0.9f;
-            float y2 = yScale * cosf(phiNext);
-            float z2 = zScale * sinf(phiNext);
-            float x3 = -0.5f + tNext * 0.9f;
-            float y3 = yScale * cosf(phi);
-            float z3 = zScale * sinf(phi);
-            float nx = cosf(phi) / yScale;
-            float ny = sinf(phi) / yScale;
-            float nz = sinf(phi) / zScale;
-            glNormal3f(nx, ny, nz);
-            glVertex3f(x0, y0, z0);
-            glVertex3f(x1, y1, z1);
-            glVertex3f(x2, y2, z2);
-            glVertex3f(x3, y3, z3);
-        }
-    }
-    glEnd();
-    glBegin(GL_QUADS);
-    for (int i = 0; i < 3; ++i) {
-        float x = -0.5f + i * 0.03f;
-        glNormal3f(0.0f, 0.0f, 1.0f);
-        glVertex3f(x, 0.05f, 0.08f);
-        glVertex3f(x + 0.01f, 0.05f, 0.08f);
-        glVertex3f(x + 0.01f, -0.05f, 0.08f);
-        glVertex3f(x, -0.05f, 0.08f);
-        glVertex3f(x, 0.05f, -0.08f);
-        glVertex3f(x + 0.01f, 0.05f, -0.08f);
-        glVertex3f(x + 0.01f, -0.05f, -0.08f);
-        glVertex3f(x, -0.05f, -0.08f);
-    }
-    glEnd();
-    glEndList();
-    checkGLError("sharkDisplayList");
-
-    pebbleDisplayList = glGenLists(1);
-    glNewList(pebbleDisplayList, GL_COMPILE);
-    glutSolidSphere(1.0f, 8, 8);
-    glEndList();
-    checkGLError("pebbleDisplayList");
-
-    seaweedDisplayList = glGenLists(1);
-    glNewList(seaweedDisplayList, GL_COMPILE);
-    glBegin(GL_TRIANGLE_STRIP);
-    for (int i = 0; i <= 5; ++i) {
-        float t = i / 5.0f;
-        float width = 0.02f * (1.0f - t);
-        glVertex3f(-width, t, 0.0f);
-        glVertex3f(width, t, 0.0f);
-    }
-    glEnd();
-    glEndList();
-    checkGLError("seaweedDisplayList");
-}
-
-void drawFish(float x, float y, float r, float g, float b, float scale, bool facingRight) {
-    glPushMatrix();
-    glTranslatef(x, y, 0);
-    glScalef(facingRight ? 1 : -1, 1, 1);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    GLfloat matDiffuse[] = {r, g, b, 1.0f};
-    GLfloat matSpecular[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    GLfloat matShininess = 50.0f;
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-    glMaterialf(GL_FRONT, GL_SHININESS, matShininess);
-
-    glPushMatrix();
-    glScalef(scale * 0.07f, scale * 0.035f, scale * 0.035f);
-    glColor3f(r + 0.1f, g + 0.1f, b + 0.1f);
-    glCallList(fishDisplayList);
-    glPopMatrix();
-
-    float tailSway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.005f) * 0.02f;
-    GLfloat tailDiffuse[] = {std::max(0.0f, r - 0.25f), std::max(0.0f, g - 0.25f), std::max(0.0f, b - 0.25f), 0.7f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, tailDiffuse);
-    glBegin(GL_QUADS);
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(-scale * 0.07f, 0.0f, 0.0f);
-    glVertex3f(-scale * 0.11f, scale * 0.04f + tailSway, 0.0f);
-    glVertex3f(-scale * 0.11f, -scale * 0.04f - tailSway, 0.0f);
-    glVertex3f(-scale * 0.07f, 0.0f, 0.0f);
-    glEnd();
-
-    GLfloat finDiffuse[] = {std::max(0.0f, r - 0.15f), std::max(0.0f, g - 0.15f), std::max(0.0f, b - 0.15f), 0.7f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, finDiffuse);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(-scale * 0.02f, scale * 0.035f, 0.0f);
-    glVertex3f(scale * 0.01f, scale * 0.06f + tailSway * 0.5f, 0.0f);
-    glVertex3f(scale * 0.04f, scale * 0.035f, 0.0f);
-    glVertex3f(-scale * 0.02f, scale * 0.035f, 0.0f);
-    glEnd();
-
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(scale * 0.02f, 0.0f, 0.0f);
-    glVertex3f(scale * 0.05f, scale * 0.015f + tailSway * 0.5f, 0.0f);
-    glVertex3f(scale * 0.05f, -scale * 0.015f - tailSway * 0.5f, 0.0f);
-    glVertex3f(scale * 0.02f, 0.0f, 0.0f);
-    glEnd();
-
-    GLfloat eyeDiffuse[] = {0.0f, 0.0f, 0.0f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, eyeDiffuse);
-    glPushMatrix();
-    glTranslatef(scale * 0.055f, scale * 0.01f, scale * 0.01f);
-    glutSolidSphere(scale * 0.007f, 10, 10);
-    glPopMatrix();
-
-    glDisable(GL_BLEND);
-    glPopMatrix();
-    checkGLError("drawFish");
-}
-
-void drawShark(float x, float y, float scale, float r, float g, float b, bool facingRight) {
-    glPushMatrix();
-    glTranslatef(x, y, 0.0f);
-    glScalef(scale, scale, scale);
-    glRotatef(180.0f, 0.0f, 1.0f, 0.0f);
-    if (!facingRight) {
-        glRotatef(180.0f, 0.0f, 1.0f, 0.0f);
-    }
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    GLfloat matDiffuse[] = {r * 0.5f, g * 0.5f, b * 0.5f, 1.0f};
-    GLfloat matSpecular[] = {0.3f, 0.3f, 0.3f, 1.0f};
-    GLfloat matShininess = 20.0f;
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-    glMaterialf(GL_FRONT, GL_SHININESS, matShininess);
-
-    float bodySway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.003f) * 0.05f;
-    glPushMatrix();
-    glTranslatef(0.0f, bodySway, 0.0f);
-    glColor3f(r * 0.5f + 0.15f, g * 0.5f + 0.15f, b * 0.5f + 0.15f);
-    glCallList(sharkDisplayList);
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(0.0f, bodySway, 0.0f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    GLfloat ventralDiffuse[] = {r * 0.8f, g * 0.8f, b * 0.8f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, ventralDiffuse);
-    for (int i = 0; i < 10; ++i) {
-        float t = i / 10.0f;
-        float tNext = (i + 1) / 10.0f;
-        float yScale = (t < 0.2f) ? (0.1f + 0.5f * t) : (0.2f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
-        float x0 = -0.5f + t * 0.9f;
-        float x1 = -0.5f + tNext * 0.9f;
-        glVertex3f(x0, -yScale, -0.05f);
-        glVertex3f(x1, -yScale, -0.05f);
-        glVertex3f(x1, -yScale, 0.05f);
-        glVertex3f(x0, -yScale, 0.05f);
-    }
-    glEnd();
-    glPopMatrix();
-
-    float finSway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.005f) * 0.05f;
-    GLfloat finDiffuse[] = {r, g, b, 0.6f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, finDiffuse);
-    glPushMatrix();
-    glTranslatef(0.0f, bodySway, 0.0f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.2f, 0.0f);
-    glVertex3f(0.2f, 0.5f + finSway, 0.05f);
-    glVertex3f(0.3f, 0.2f, 0.05f);
-    glVertex3f(0.0f, 0.2f, 0.0f);
-    glVertex3f(0.1f, 0.0f, 0.0f);
-    glVertex3f(0.3f, -0.2f - finSway, 0.1f);
-    glVertex3f(0.05f, -0.1f, 0.05f);
-    glVertex3f(0.1f, 0.0f, 0.0f);
-    glVertex3f(0.1f, 0.0f, 0.0f);
-    glVertex3f(0.3f, 0.2f + finSway, -0.1f);
-    glVertex3f(0.05f, 0.1f, -0.05f);
-    glVertex3f(0.1f, 0.0f, 0.0f);
-    glEnd();
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(0.4f, bodySway, 0.0f);
-    glRotatef(finSway * 20.0f, 0.0f, 1.0f, 0.0f);
-    glTranslatef(-0.4f, 0.0f, 0.0f);
-    glBegin(GL_QUADS);
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(0.4f, 0.0f, 0.0f);
-    glVertex3f(0.6f, 0.25f, 0.05f);
-    glVertex3f(0.6f, -0.25f, 0.05f);
-    glVertex3f(0.4f, 0.0f, 0.0f);
-    glEnd();
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(-0.3f, 0.08f, 0.08f);
-    GLfloat eyeDiffuse[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, eyeDiffuse);
-    glutSolidSphere(0.03f, 10, 10);
-    glTranslatef(0.0f, 0.0f, 0.01f);
-    GLfloat pupilDiffuse[] = {0.0f, 0.0f, 0.0f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, pupilDiffuse);
-    glScalef(0.01f, 0.02f, 0.01f);
-    glutSolidSphere(1.0f, 8, 8);
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef(-0.3f, 0.08f, -0.08f);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, eyeDiffuse);
-    glutSolidSphere(0.03f, 10, 10);
-    glTranslatef(0.0f, 0.0f, -0.01f);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, pupilDiffuse);
-    glScalef(0.01f, 0.02f, 0.01f);
-    glutSolidSphere(1.0f, 8, 8);
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef(-0.3f, 0.08f, 0.08f);
-    GLfloat membraneDiffuse[] = {1.0f, 1.0f, 1.0f, 0.3f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, membraneDiffuse);
-    glScalef(0.02f, 0.02f, 0.01f);
-    glutSolidSphere(1.0f, 8, 8);
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef(-0.3f, 0.08f, -0.08f);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, membraneDiffuse);
-    glScalef(0.02f, 0.02f, 0.01f);
-    glutSolidSphere(1.0f, 8, 8);
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(-0.35f, 0.0f, 0.0f);
-    glDisable(GL_LIGHTING);
-    glColor3f(0.8f, 0.2f, 0.2f);
-    glBegin(GL_QUADS);
-    glVertex3f(0.0f, 0.05f, 0.05f);
-    glVertex3f(0.05f, 0.05f, 0.05f);
-    glVertex3f(0.05f, -0.05f, 0.05f);
-    glVertex3f(0.0f, -0.05f, 0.05f);
-    glVertex3f(0.0f, 0.05f, -0.05f);
-    glVertex3f(0.05f, 0.05f, -0.05f);
-    glVertex3f(0.05f, -0.05f, -0.05f);
-    glVertex3f(0.0f, -0.05f, -0.05f);
-    glEnd();
-    glColor3f(1.0f, 1.0f, 1.0f);
-    glBegin(GL_TRIANGLES);
-    glVertex3f(0.05f, 0.04f, 0.05f);
-    glVertex3f(0.05f, 0.02f, 0.05f);
-    glVertex3f(0.03f, 0.03f, 0.05f);
-    glVertex3f(0.05f, -0.02f, 0.05f);
-    glVertex3f(0.05f, -0.04f, 0.05f);
-    glVertex3f(0.03f, -0.03f, 0.05f);
-    glVertex3f(0.05f, 0.04f, -0.05f);
-    glVertex3f(0.05f, 0.02f, -0.05f);
-    glVertex3f(0.03f, 0.03f, -0.05f);
-    glVertex3f(0.05f, -0.02f, -0.05f);
-    glVertex3f(0.05f, -0.04f, -0.05f);
-    glVertex3f(0.03f, -0.03f, -0.05f);
-    glEnd();
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
-
-    glDisable(GL_BLEND);
-    glPopMatrix();
-    checkGLError("drawShark");
-}
-
-void drawBubble(float x, float y, float radius) {
-    glDisable(GL_LIGHTING);
-    glColor4f(0.6f, 0.9f, 1.0f, 0.5f);
-    glBegin(GL_TRIANGLE_FAN);
-    glVertex2f(x, y);
-    for (int i = 0; i <= 12; i++) {
-        float angle = i * 3.1416f / 6;
-        glVertex2f(x + radius * cosf(angle), y + radius * sinf(angle));
-    }
-    glEnd();
-    glEnable(GL_LIGHTING);
-    checkGLError("drawBubble");
-}
-
-void drawRock(float x, float scale, float r, float g, float b) {
-    glPushMatrix();
-    glTranslatef(x, -0.85f, 0.0f);
-    glScalef(scale, scale * 0.6f, scale);
-    GLfloat matDiffuse[] = {r, g, b, 1.0f};
-    GLfloat matSpecular[] = {0.2f, 0.2f, 0.2f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-    glMaterialf(GL_FRONT, GL_SHININESS, 10.0f);
-    glutSolidSphere(1.0f, 15, 15);
-    glPopMatrix();
-    checkGLError("drawRock");
-}
-
-void drawGrass() {
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (float x = -1.0f; x < 1.0f; x += 0.02f) {
-        float height = 0.08f + (float(rand()) / RAND_MAX) * 0.08f;
-        float sway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.002f + x * 5.0f) * 0.02f;
-        float green = 0.3f + (float(rand()) / RAND_MAX) * 0.3f;
-        glColor4f(0.0f, green, 0.0f, 0.8f);
-        glBegin(GL_QUADS);
-        glVertex2f(x, -0.8f);
-        glVertex2f(x + 0.005f, -0.8f);
-        glVertex2f(x + 0.005f + sway, -0.8f + height);
-        glVertex2f(x + sway, -0.8f + height);
-        glEnd();
-    }
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
-    checkGLError("drawGrass");
-}
-
-void drawPebbles() {
-    glEnable(GL_LIGHTING);
-    srand(12345);
-    for (int i = 0; i < 50; ++i) {
-        float x = (float(rand()) / RAND_MAX) * 2.0f - 1.0f;
-        float y = -0.85f + (float(rand()) / RAND_MAX) * 0.05f;
-        float scale = 0.01f + (float(rand()) / RAND_MAX) * 0.02f;
-        float r = 0.4f + (float(rand()) / RAND_MAX) * 0.3f;
-        float g = 0.3f + (float(rand()) / RAND_MAX) * 0.3f;
-        float b = 0.2f + (float(rand()) / RAND_MAX) * 0.3f;
-        glPushMatrix();
-        glTranslatef(x, y, 0.0f);
-        glScalef(scale, scale, scale);
-        GLfloat matDiffuse[] = {r, g, b, 1.0f};
-        GLfloat matSpecular[] = {0.1f, 0.1f, 0.1f, 1.0f};
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-        glMaterialf(GL_FRONT, GL_SHININESS, 5.0f);
-        glCallList(pebbleDisplayList);
-        glPopMatrix();
-    }
-    srand((unsigned)time(nullptr));
-    checkGLError("drawPebbles");
-}
-
-void drawSeaweed() {
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (const auto& seaweed : seaweeds) {
-        glPushMatrix();
-        glTranslatef(seaweed.x, -0.8f, 0.0f);
-        glScalef(1.0f, seaweed.height, 1.0f);
-        float sway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.0015f + seaweed.x * 3.0f) * 0.05f;
-        glTranslatef(sway, 0.0f, 0.0f);
-        glColor4f(0.0f, seaweed.green, 0.0f, 0.7f);
-        glCallList(seaweedDisplayList);
-        glPopMatrix();
-    }
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
-    checkGLError("drawSeaweed");
-}
-
-void drawRipples() {
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (const auto& ripple : ripples) {
-        glColor4f(0.7f, 0.9f, 1.0f, ripple.life * 0.5f);
-        glBegin(GL_LINE_LOOP);
-        for (int i = 0; i < 24; ++i) {
-            float angle = i * 2.0f * 3.1416f / 24;
-            glVertex2f(ripple.x + ripple.radius * cosf(angle), ripple.y + ripple.radius * sinf(angle));
-        }
-        glEnd();
-    }
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
-    checkGLError("drawRipples");
-}
-
-void drawCrab(float x, float y, float scale, float r, float g, float b, bool facingRight) {
-    std::cout << "Drawing crab at x=" << x << ", y=" << y << ", scale=" << scale << std::endl;
-    glPushMatrix();
-    glTranslatef(x, y, 0.02f);
-    glScalef(facingRight ? scale : -scale, scale, scale);
-    glEnable(GL_LIGHTING);
-    glDisable(GL_BLEND);
-
-    GLfloat matDiffuse[] = {r, g, b, 1.0f};
-    GLfloat matSpecular[] = {0.4f, 0.4f, 0.4f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, matSpecular);
-    glMaterialf(GL_FRONT, GL_SHININESS, 30.0f);
-    glPushMatrix();
-    glScalef(0.1f, 0.04f, 0.05f);
-    glutSolidSphere(1.0f, 12, 12);
-    glPopMatrix();
-
-    float legSway = sinf(glutGet(GLUT_ELAPSED_TIME) * 0.01f) * 0.015f;
-    GLfloat legDiffuse[] = {r * 0.8f, g * 0.8f, b * 0.8f, 1.0f};
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, legDiffuse);
-
-    glPushMatrix();
-    glTranslatef(0.04f, 0.0f, 0.025f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.0f, 0.0f);
-    glVertex3f(0.04f, 0.02f + legSway, 0.0f);
-    glVertex3f(0.04f, 0.02f + legSway, -0.008f);
-    glVertex3f(0.0f, 0.0f, -0.008f);
-    glEnd();
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(0.02f, 0.0f, 0.025f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.0f, 0.0f);
-    glVertex3f(0.04f, -0.02f - legSway, 0.0f);
-    glVertex3f(0.04f, -0.02f - legSway, -0.008f);
-    glVertex3f(0.0f, 0.0f, -0.008f);
-    glEnd();
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(-0.04f, 0.0f, 0.025f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.0f, 0.0f);
-    glVertex3f(-0.04f, 0.02f + legSway, 0.0f);
-    glVertex3f(-0.04f, 0.02f + legSway, -0.008f);
-    glVertex3f(0.0f, 0.0f, -0.008f);
-    glEnd();
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(-0.02f, 0.0f, 0.025f);
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(0.0f, 0.0f, 0.0f);
-    glVertex3f(-0.04f, -0.02f - legSway, 0.0f);
-    glVertex3f(-0.04f, -0.02f - legSway, -0.008f);
-    glVertex3f(0.0f, 0.0f, -0.008f);
-    glEnd();
-    glPopMatrix();
-
-    glPopMatrix();
-    checkGLError("drawCrab");
-}
-
-void drawBackground() {
-    glClearColor(0.0f, 0.4f, 0.7f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    checkGLError("clear");
-
-    glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    float topY = 1.0f;
-    float bottomY = -0.8f;
-    int numSteps = 50;
-    float stepSize = (topY - bottomY) / numSteps;
-
-    float topColor[3] = {0.3f, 0.6f, 0.9f};
-    float bottomColor[3] = {0.1f, 0.3f, 0.5f};
-
-    glPushMatrix();
-    glTranslatef(0.0f, 0.0f, -9.0f);
-    for (int i = 0; i < numSteps; ++i) {
-        float y0 = topY - i * stepSize;
-        float y1 = topY - (i + 1) * stepSize;
-        float t = (float)i / (numSteps - 1);
-
-        float r = topColor[0] + t * (bottomColor[0] - topColor[0]);
-        float g = topColor[1] + t * (bottomColor[1] - topColor[1]);
-        float b = topColor[2] + t * (bottomColor[2] - topColor[2]);
-
-        glBegin(GL_QUADS);
-        glColor4f(r, g, b, 1.0f);
-        glVertex2f(-1.0f, y0);
-        glVertex2f(1.0f, y0);
-        glColor4f(r + (bottomColor[0] - topColor[0]) / numSteps,
-                  g + (bottomColor[1] - topColor[1]) / numSteps,
-                  b + (bottomColor[2] - topColor[2]) / numSteps, 1.0f);
-        glVertex2f(1.0f, y1);
-        glVertex2f(-1.0f, y1);
-        glEnd();
-    }
-    glPopMatrix();
-
-    glEnable(GL_DEPTH_TEST);
-    glColor3f(0.76f, 0.7f, 0.5f);
-    glBegin(GL_QUADS);
-    glVertex2f(-1.0f, -0.8f);
-    glVertex2f(1.0f, -0.8f);
-    glVertex2f(1.0f, -1.0f);
-    glVertex2f(-1.0f, -1.0f);
-    glEnd();
-
-    glBegin(GL_QUADS);
-    for (float x = -1.0f; x < 1.0f; x += 0.03f) {
-        for (float y = -1.0f; y < -0.8f; y += 0.03f) {
-            float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
-            float caustic1 = 0.5f + 0.5f * sinf(x * 10 + y * 10 + t);
-            float caustic2 = 0.5f + 0.5f * sinf(x * 15 - y * 12 + t * 0.7f);
-            float caustic = (caustic1 + caustic2) * 0.5f;
-            glColor4f(0.8f, 0.9f, 1.0f, caustic * 0.4f);
-            glVertex2f(x, y);
-            glVertex2f(x + 0.03f, y);
-            glVertex2f(x + 0.03f, y + 0.03f);
-            glVertex2f(x, y + 0.03f);
-        }
-    }
-    glEnd();
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
-    checkGLError("drawBackground");
-}
-
-void updateFish() {
-    std::vector<Fish> newFishList;
-    std::vector<Food> newFoodList = foodList;
-    for (auto& f : fishList) {
-        bool eaten = false;
-        float avgAngle = f.angle;
-        int nearbyCount = 1;
-        float minFoodDist = 0.5f;
-        float foodAngle = f.angle;
-        bool foodNearby = false;
-
-        for (auto& s : sharkList) {
-            float dx = f.x - s.x;
-            float dy = f.y - s.y;
-            float dist = sqrtf(dx * dx + dy * dy);
-            if (dist < 0.12f) {
-                eaten = true;
-                s.hunger = std::min(1.0f, s.hunger + 0.2f);
-                break;
-            }
-            if (dist < 0.3f) {
-                float fleeAngle = atan2f(dy, dx);
-                f.angle = fleeAngle;
-                f.speed = 0.01f;
-                f.facingRight = dx > 0;
-                break;
-            }
-        }
-
-        if (!eaten) {
-            for (auto it = newFoodList.begin(); it != newFoodList.end();) {
-                float dx = it->x - f.x;
-                float dy = it->y - f.y;
-                float dist = sqrtf(dx * dx + dy * dy);
-                if (dist < 0.05f) {
-                    it = newFoodList.erase(it);
-                    continue;
-                }
-                if (dist < minFoodDist) {
-                    minFoodDist = dist;
-                    foodAngle = atan2f(dy, dx);
-                    foodNearby = true;
-                }
-                ++it;
-            }
-
-            if (foodNearby) {
-                f.angle = f.angle * 0.4f + foodAngle * 0.6f;
-                f.speed = 0.008f;
-                f.facingRight = cosf(foodAngle) > 0;
-            } else {
-                for (const auto& rock : rocks) {
-                    float dx = f.x - rock.x;
-                    float dy = f.y - (-0.85f);
-                    float dist = sqrtf(dx * dx + dy * dy);
-                    if (dist < 0.1f) {
-                        float repelAngle = atan2f(dy, dx);
-                        avgAngle += repelAngle;
-                        nearbyCount++;
-                    }
-                }
-                for (const auto& other : fishList) {
-                    if (&other != &f) {
-                        float dx = f.x - other.x;
-                        float dy = f.y - other.y;
-                        float dist = sqrtf(dx * dx + dy * dy);
-                        if (dist < 0.2f) {
-                            avgAngle += other.angle;
-                            nearbyCount++;
-                        }
-                    }
-                }
-                f.angle = f.angle * 0.8f + (avgAngle / nearbyCount) * 0.2f;
-                if (rand() % 100 < 2) {
-                    f.angle += (float(rand()) / RAND_MAX - 0.5f) * 0.5f;
-                }
-                f.speed = 0.002f + (float(rand()) / RAND_MAX) * 0.005f;
-                f.facingRight = cosf(f.angle) > 0;
-            }
-
-            f.x += f.speed * cosf(f.angle);
-            f.y += f.speed * 0.1f * sinf(f.angle);
-            if (f.x > 1.2f) {
-                f.x = -1.2f;
-                f.facingRight = true;
-                f.angle = 0.0f;
-            } else if (f.x < -1.2f) {
-                f.x = 1.2f;
-                f.facingRight = false;
-                f.angle = 3.1416f;
-            }
-            if (f.y > 0.7f) f.y = 0.7f;
-            if (f.y < -0.6f) f.y = -0.6f;
-            newFishList.push_back(f);
-        }
-    }
-    fishList = newFishList;
-    foodList = newFoodList;
-    checkGLError("updateFish");
-}
-
-void updateSharks() {
-    for (auto& s : sharkList) {
-        s.hunger -= 0.001f;
-        if (s.hunger < 0.0f) s.hunger = 0.0f;
-        s.stateTimer -= 0.016f;
-
-        if (s.stateTimer <= 0.0f) {
-            if (s.hunger > 0.6f && rand() % 100 < 70) {
-                s.state = Shark::State::Chase;
-                s.stateTimer = 5.0f + (float(rand()) / RAND_MAX) * 5.0f;
-            } else if (s.hunger < 0.3f && rand() % 100 < 50) {
-                s.state = Shark::State::Rest;
-                s.stateTimer = 3.0f + (float(rand()) / RAND_MAX) * 3.0f;
-            } else if (rand() % 100 < 60) {
-                s.state = Shark::State::Patrol;
-                s.stateTimer = 5.0f + (float(rand()) / RAND_MAX) * 5.0f;
-            } else {
-                s.state = Shark::State::Idle;
-                s.stateTimer = 2.0f + (float(rand()) / RAND_MAX) * 3.0f;
-            }
-        }
-
-        float minDist = 1e9;
-        float targetAngle = s.angle;
-        bool targetFound = false;
-
-        switch (s.state) {
-            case Shark::State::Chase:
-                for (const auto& f : fishList) {
-                    float dx = f.x - s.x;
-                    float dy = f.y - s.y;
-                    float dist = sqrtf(dx * dx + dy * dy);
-                    if (dist < minDist) {
-                        minDist = dist;
-                        targetAngle = atan2f(dy, dx);
-                        targetFound = true;
-                    }
-                }
-                s.speed = 0.015f * (0.5f + s.hunger);
-                break;
-
-            case Shark::State::Patrol:
-                if (rand() % 100 < 10) {
-                    targetAngle += (float(rand()) / RAND_MAX - 0.5f) * 0.5f;
-                }
-                s.speed = 0.006f;
-                break;
-
-            case Shark::State::Idle:
-                s.speed = 0.002f;
-                if (rand() % 100 < 5) {
-                    targetAngle += (float(rand()) / RAND_MAX - 0.5f) * 0.3f;
-                }
-                break;
-
-            case Shark::State::Rest:
-                s.speed = 0.0f;
-                break;
-        }
-
-        if (s.state != Shark::State::Rest) {
-            for (const auto& rock : rocks) {
-                float dx = s.x - rock.x;
-                float dy = s.y - (-0.85f);
-                float dist = sqrtf(dx * dx + dy * dy);
-                if (dist < 0.1f) {
-                    float repelAngle = atan2f(dy, dx);
-                    targetAngle = s.angle * 0.5f + repelAngle * 0.5f;
-                }
-            }
-        }
-
-        if (targetFound && s.state == Shark::State::Chase && minDist < 0.5f) {
-            s.angle = s.angle * 0.6f + targetAngle * 0.4f;
-        } else {
-            s.angle = s.angle * 0.8f + targetAngle * 0.2f;
-        }
-        s.facingRight = cosf(s.angle) > 0;
-        s.x += s.speed * cosf(s.angle);
-        s.y += s.speed * 0.1f * sinf(s.angle);
-
-        if (s.x > 1.3f) {
-            s.x = -1.3f;
-            s.facingRight = true;
-            s.angle = 0.0f;
-        } else if (s.x < -1.3f) {
-            s.x = 1.3f;
-            s.facingRight = false;
-            s.angle = 3.1416f;
-        }
-        if (s.y > 0.6f) s.y = 0.6f;
-        if (s.y < -0.5f) s.y = -0.5f;
-    }
-    checkGLError("updateSharks");
-}
-
-void updateBubbles() {
-    for (auto& b : bubbles) {
-        b.y += 0.006f;
-        b.x += sinf(b.y * 10.0f) * 0.002f;
-        if (b.y > 1.1f) {
-            b.x = (float(rand()) / RAND_MAX) * 2.0f - 1.0f;
-            b.y = -1.0f;
-            b.radius = 0.01f + (float(rand()) / RAND_MAX) * 0.02f;
-        }
-    }
-    checkGLError("updateBubbles");
-}
-
-void updateRipples() {
-    for (auto& r : ripples) {
-        r.radius += 0.005f;
-        r.life -= 0.02f;
-    }
-    ripples.erase(std::remove_if(ripples.begin(), ripples.end(),
-        [](const Ripple& r) { return r.life <= 0.0f; }), ripples.end());
-    checkGLError("updateRipples");
-}
-
-void updateCrabs() {
-    for (auto& c : crabs) {
-        c.x += c.speed;
-        c.y += (float(rand()) / RAND_MAX - 0.5f) * 0.002f;
-        if (rand() % 100 < 5) {
-            c.speed += (float(rand()) / RAND_MAX - 0.5f) * 0.001f;
-            c.speed = std::max(-0.004f, std::min(0.004f, c.speed));
-        }
-
-        bool reverse = false;
-        if (c.x > 1.0f || c.x < -1.0f || c.y > -0.8f || c.y < -0.85f) {
-            reverse = true;
-        }
-        for (const auto& rock : rocks) {
-            float dx = c.x - rock.x;
-            float dy = c.y - (-0.85f);
-            float dist = sqrtf(dx * dx + dy * dy);
-            if (dist < 0.1f) {
-                reverse = true;
-                break;
-            }
-        }
-        if (reverse) {
-            c.speed = -c.speed;
-            c.facingRight = c.speed > 0;
-            c.y = std::max(-0.85f, std::min(-0.8f, c.y));
-        }
-        std::cout << "Updated crab at x=" << c.x << ", y=" << c.y << ", speed=" << c.speed << std::endl;
-    }
-    checkGLError("updateCrabs");
-}
-
-void display() {
-    float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
-    GLfloat lightPos[] = {0.5f * cosf(t), 0.5f * sinf(t), 1.0f, 0.0f};
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-    checkGLError("updateLight");
-
-    drawBackground();
-    drawPebbles();
-    std::cout << "Drawing " << crabs.size() << " crabs" << std::endl;
-    for (const auto& c : crabs) {
-        drawCrab(c.x, c.y, c.scale, c.r, c.g, c.b, c.facingRight);
-    }
-    for (const auto& rock : rocks) {
-        drawRock(rock.x, rock.scale, rock.r, rock.g, rock.b);
-    }
-    drawGrass();
-    drawSeaweed();
-    for (const auto& b : bubbles) {
-        drawBubble(b.x, b.y, b.radius);
-    }
-    drawRipples();
-    for (const auto& f : fishList) {
-        drawFish(f.x, f.y, f.r, f.g, f.b, f.scale, f.facingRight);
-    }
-    for (const auto& s : sharkList) {
-        drawShark(s.x, s.y, s.scale, s.r, s.g, s.b, s.facingRight);
-    }
-    glDisable(GL_LIGHTING);
-    glPointSize(3.0f);
-    glColor3f(1.0f, 0.5f, 0.0f);
-    glBegin(GL_POINTS);
-    for (const auto& food : foodList) {
-        glVertex2f(food.x, food.y);
-    }
-    glEnd();
-    glEnable(GL_LIGHTING);
-    glutSwapBuffers();
-    checkGLError("display");
-}
-
-void timer(int value) {
-    updateFish();
-    updateSharks();
-    updateBubbles();
-    updateRipples();
-    updateCrabs();
-    for (auto& food : foodList) {
-        food.life -= 0.016f;
-    }
-    foodList.erase(std::remove_if(foodList.begin(), foodList.end(),
-        [](const Food& f) { return f.life <= 0; }), foodList.end());
-    glutPostRedisplay();
-    glutTimerFunc(16, timer, 0);
-}
-
-void keyboard(unsigned char key, int x, int y) {
-    if (key == 'r') {
-        initialize();
-    }
-    if (key == 'p') {
-        usePerspective = !usePerspective;
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        if (usePerspective) {
-            gluPerspective(60.0, (float)windowWidth / windowHeight, 0.1, 10.0);
-            glTranslatef(0.0f, 0.0f, -2.0f);
-        } else {
-            glOrtho(-1.0, 1.0, -1.0, 1.0, -1.0, 10.0);
-        }
-        glMatrixMode(GL_MODELVIEW);
-        checkGLError("keyboard projection");
-    }
-    if (key == 'f') {
-        isFullScreen = !isFullScreen;
-        if (isFullScreen) {
-            glutFullScreen();
-        } else {
-            glutReshapeWindow(900, 600);
-            glutPositionWindow(300, 100);
-        }
-        checkGLError("full screen toggle");
-    }
-    glutPostRedisplay();
-}
-
-void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-        float wx = (2.0f * x / (float)windowWidth) - 1.0f;
-        float wy = 1.0f - (2.0f * y / (float)windowHeight);
-        foodList.push_back({ wx, wy, 10.0f });
-        ripples.push_back({ wx, wy, 0.01f, 1.0f });
-        std::cout << "Added food at wx=" << wx << ", wy=" << wy << std::endl;
-    }
-}
-
-void initialize() {
-    srand((unsigned)time(nullptr));
-    fishList.clear();
-    sharkList.clear();
-    bubbles.clear();
-    foodList.clear();
-    rocks.clear();
-    seaweeds.clear();
-    ripples.clear();
-    crabs.clear();
-
-    for (int i = 0; i < 35; ++i) {
-        bool right = rand() % 2 == 0;
-        fishList.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            (float(rand()) / RAND_MAX) * 1.3f - 0.6f,
-            0.002f + (float(rand()) / RAND_MAX) * 0.005f,
-            right ? 0.0f : 3.1416f,
-            (0.05f + (float(rand()) / RAND_MAX) * 0.07f) * 4.5f,
-            (float(rand()) / RAND_MAX),
-            (float(rand()) / RAND_MAX),
-            (float(rand()) / RAND_MAX),
-            right
-        });
-    }
-
-    for (int i = 0; i < 3; ++i) {
-        bool right = rand() % 2 == 0;
-        sharkList.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            (float(rand()) / RAND_MAX) * 1.0f - 0.5f,
-            (0.002f + (float(rand()) / RAND_MAX) * 0.004f) * 0.5f,
-            right ? 0.0f : 3.1416f,
-            0.2f + (float(rand()) / RAND_MAX) * 0.15f,
-            0.4f + (float(rand()) / RAND_MAX) * 0.1f,
-            0.4f + (float(rand()) / RAND_MAX) * 0.1f,
-            0.4f + (float(rand()) / RAND_MAX) * 0.1f,
-            right,
-            (float(rand()) / RAND_MAX),
-            Shark::State::Patrol,
-            5.0f + (float(rand()) / RAND_MAX) * 5.0f
-        });
-    }
-
-    for (int i = 0; i < 15; ++i) {
-        bubbles.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            0.01f + (float(rand()) / RAND_MAX) * 0.02f
-        });
-    }
-
-    for (int i = 0; i < 5; ++i) {
-        rocks.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            0.05f + (float(rand()) / RAND_MAX) * 0.1f,
-            0.4f + (float(rand()) / RAND_MAX) * 0.2f,
-            0.3f + (float(rand()) / RAND_MAX) * 0.2f,
-            0.2f + (float(rand()) / RAND_MAX) * 0.2f
-        });
-    }
-
-    for (int i = 0; i < 12; ++i) {
-        seaweeds.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            0.2f + (float(rand()) / RAND_MAX) * 0.2f,
-            0.4f + (float(rand()) / RAND_MAX) * 0.3f
-        });
-    }
-
-    for (int i = 0; i < 8; ++i) {
-        bool right = rand() % 2 == 0;
-        float speed = right ? (0.002f + (float(rand()) / RAND_MAX) * 0.002f) : -(0.002f + (float(rand()) / RAND_MAX) * 0.002f);
-        crabs.push_back({
-            (float(rand()) / RAND_MAX) * 2.0f - 1.0f,
-            -0.83f,
-            speed,
-            0.06f + (float(rand()) / RAND_MAX) * 0.02f,
-            0.9f + (float(rand()) / RAND_MAX) * 0.1f,
-            0.2f + (float(rand()) / RAND_MAX) * 0.1f,
-            0.1f + (float(rand()) / RAND_MAX) * 0.1f,
-            right
-        });
-        std::cout << "Initialized crab " << i << " at x=" << crabs.back().x << ", y=" << crabs.back().y << ", speed=" << speed << std::endl;
-    }
-
-    initDisplayLists();
-}
-
-int main(int argc, char** argv) {
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-    glutInitWindowSize(windowWidth, windowHeight);
-    glutInitWindowPosition(300, 100);
-    int window = glutCreateWindow("Interactive Underwater World");
-    if (window == 0) {
-        std::cerr << "Failed to create GLUT window" << std::endl;
-        return -1;
-    }
-
-    initGL();
-    initialize();
-
-    glutDisplayFunc(display);
-    glutReshapeFunc(reshape);
-    glutTimerFunc(0, timer, 0);
-    glutKeyboardFunc(keyboard);
-    glutMouseFunc(mouse);
-
-    glutMainLoop();
-    return 0;
-}
+#ifdef _WIN32
+// Winsock has to come before anything that includes windows.h
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <GL/gl.h>
+#include <GL/glu.h>
+#include <GL/glut.h>
+#include <GL/freeglut_ext.h>
+#include <GL/glext.h>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <ctime>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include "trajectory.h"
+
+struct World;
+void initialize(World& world, void (*stage)() = nullptr);
+void emitBubbleBurst(World& world, float x, float y, int count);
+
+// Global variables to store current window size
+int windowWidth = 900;
+int windowHeight = 600;
+bool isFullScreen = false;
+
+// Stable reference to an entity in an Archetype. A slot's generation changes
+// whenever its entity is removed, so a stale handle never resolves to a newcomer.
+struct EntityHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+// Components. A species is the set of components its archetype stores, and
+// the systems below pick their behaviour from which components are present.
+struct Motion {
+    float x, y;
+    float speed, angle;
+    bool facingRight;
+};
+
+struct Appearance {
+    float scale;
+    float r, g, b;
+};
+
+// Heading to turn toward this tick and how far to turn (0..1)
+struct Steering {
+    float targetAngle = 0.0f;
+    float blend = 0.0f;
+};
+
+// Moves along its heading and wraps around the sides of the tank
+struct Swimmer {};
+
+// Walks along the sand and turns back at the edges and at rocks
+struct Walker {
+    bool blocked = false;
+};
+
+// Flocking neighbourhood, refreshed by fishScheduler
+struct Schooling {
+    float flockAngleSum = 0.0f;
+    int flockCount = 0;
+    long nextDecision = 0;
+};
+
+// Steers toward and eats nearby food
+struct Forager {};
+
+// Flees from and can be eaten by anything with a Predator component
+struct Prey {};
+
+enum class PredatorState { Idle, Patrol, Chase, Rest };
+
+struct Predator {
+    float hunger;
+    PredatorState state;
+    float stateTimer;
+    // Prey picked by the last decision; stays valid until that fish is eaten
+    EntityHandle target;
+    long nextDecision = 0;
+};
+
+// Region an archetype lives in: swimmers wrap at +-limitX, walkers turn back
+struct Bounds {
+    float limitX, minY, maxY;
+};
+
+template <bool... Bs> struct AnyOf : std::false_type {};
+template <bool B, bool... Bs> struct AnyOf<B, Bs...> : std::integral_constant<bool, B || AnyOf<Bs...>::value> {};
+
+// All entities with one combination of components. Every component has its
+// own densely packed column, so a system streams through only the data it
+// uses. Handles go through a slot table and freed slots are recycled from a
+// free list, so nothing allocates after reset().
+template <typename... Components>
+struct Archetype {
+    std::tuple<std::vector<Components>...> columns;
+    std::vector<uint32_t> itemSlot;     // slot owning row i
+    std::vector<uint32_t> slotItem;     // row of a slot's entity
+    std::vector<uint32_t> generations;
+    std::vector<uint32_t> freeSlots;
+    Bounds bounds = { 1.0f, -1.0f, 1.0f };
+
+    template <typename F>
+    void forEachColumn(F f) {
+        int expand[] = { 0, (f(std::get<std::vector<Components>>(columns)), 0)... };
+        (void)expand;
+    }
+
+    void reset(size_t capacity) {
+        forEachColumn([capacity](auto& column) {
+            column.clear();
+            column.reserve(capacity);
+        });
+        itemSlot.clear();
+        itemSlot.reserve(capacity);
+        slotItem.assign(capacity, 0);
+        // Bump rather than zero so handles from before a reset stay dead
+        generations.resize(capacity, 0);
+        for (auto& g : generations) ++g;
+        freeSlots.clear();
+        for (size_t slot = capacity; slot-- > 0;) {
+            freeSlots.push_back((uint32_t)slot);
+        }
+    }
+
+    size_t size() const { return itemSlot.size(); }
+    bool full() const { return freeSlots.empty(); }
+
+    // Returns an invalid handle when the archetype is full
+    EntityHandle spawn(const Components&... values) {
+        if (freeSlots.empty()) return EntityHandle();
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        slotItem[slot] = (uint32_t)itemSlot.size();
+        itemSlot.push_back(slot);
+        int expand[] = { 0, (std::get<std::vector<Components>>(columns).push_back(values), 0)... };
+        (void)expand;
+        return { slot, generations[slot] };
+    }
+
+    // Adds up to `count` value-initialised rows to be filled in place and
+    // returns the first of them
+    size_t spawnRows(size_t count) {
+        size_t first = itemSlot.size();
+        count = std::min(count, freeSlots.size());
+        forEachColumn([count](auto& column) { column.resize(column.size() + count); });
+        for (size_t n = 0; n < count; ++n) {
+            uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            slotItem[slot] = (uint32_t)itemSlot.size();
+            itemSlot.push_back(slot);
+        }
+        return first;
+    }
+
+    // Moves the last row into the freed one, so only that entity changes row
+    void despawn(EntityHandle handle) {
+        if (!alive(handle)) return;
+        uint32_t i = slotItem[handle.index];
+        uint32_t last = (uint32_t)itemSlot.size() - 1;
+        forEachColumn([i, last](auto& column) {
+            if (i != last) column[i] = column[last];
+            column.pop_back();
+        });
+        if (i != last) {
+            itemSlot[i] = itemSlot[last];
+            slotItem[itemSlot[i]] = i;
+        }
+        itemSlot.pop_back();
+        ++generations[handle.index];
+        freeSlots.push_back(handle.index);
+    }
+
+    bool alive(EntityHandle handle) const {
+        return handle.index < generations.size() && generations[handle.index] == handle.generation;
+    }
+
+    // Row of a live entity, or -1
+    int find(EntityHandle handle) const {
+        return alive(handle) ? (int)slotItem[handle.index] : -1;
+    }
+
+    EntityHandle handleAt(size_t i) const {
+        uint32_t slot = itemSlot[i];
+        return { slot, generations[slot] };
+    }
+};
+
+template <typename C, typename A> struct HasComponent;
+template <typename C, typename... Cs>
+struct HasComponent<C, Archetype<Cs...>> : AnyOf<std::is_same<C, Cs>::value...> {};
+
+template <typename C, typename... Cs>
+std::vector<C>& column(Archetype<Cs...>& archetype) {
+    return std::get<std::vector<C>>(archetype.columns);
+}
+
+template <typename C, typename... Cs>
+const std::vector<C>& column(const Archetype<Cs...>& archetype) {
+    return std::get<std::vector<C>>(archetype.columns);
+}
+
+// Species. Adding one is a matter of choosing its components
+using FishArchetype = Archetype<Motion, Appearance, Steering, Swimmer, Schooling, Forager, Prey>;
+using SharkArchetype = Archetype<Motion, Appearance, Steering, Swimmer, Predator>;
+using CrabArchetype = Archetype<Motion, Appearance, Walker>;
+
+// Spreads expensive per-entity decisions across ticks. Every entity carries
+// its own nextDecision tick, so work is staggered instead of landing on the
+// same frame, and a per-tick time budget defers whatever does not fit.
+struct AIScheduler {
+    int interval;       // ticks between decisions for a fully active entity
+    double budgetMs;    // wall-clock budget for decisions in one tick
+    long tick = 0;
+    size_t cursor = 0;  // round-robin start so deferred entities go first next tick
+    int decisions = 0;  // made during the last tick
+    int deferred = 0;   // due but skipped because the budget ran out
+};
+
+struct Food {
+    float x, y;
+    float life;
+};
+
+struct Rock {
+    float x, scale;
+    float r, g, b;
+};
+
+struct Seaweed {
+    float x, height;
+    float green;
+};
+
+struct Ripple {
+    float x, y;
+    float radius;
+    float life;
+};
+
+// Ripples all age at the same rate, so the oldest always expires first and a
+// FIFO ring is enough to retire them without erasing from the middle.
+struct RippleRing {
+    std::vector<Ripple> slots;
+    int head = 0;   // index of the oldest live ripple
+    int count = 0;
+};
+
+// Per-node links of the steering grid (see bakeFlowField): the nearest rock
+// and food pellet in range of each node, or -1
+struct FlowField {
+    std::vector<int16_t> rock;
+    std::vector<int32_t> food;
+    std::vector<float> foodDistSq;           // from each node to its linked pellet
+    std::vector<std::vector<int32_t>> cellFood;  // pellets in each grid cell
+    std::vector<int> orphans;                // scratch for removeFood
+};
+
+// Cached unit circle for a given segment count; entry [segments] repeats [0]
+struct CircleTable {
+    int segments;
+    std::vector<float> cosTable, sinTable;
+};
+
+// Tunables; defaults can be overridden from the command line (see parseArgs)
+struct Config {
+    int bubbleCapacity = 4096;
+    int initialBubbles = 15;
+    float ambientBubbleRate = 3.0f;   // bubbles per second rising from the sand
+    float seaweedBubbleRate = 0.5f;   // bubbles per second per seaweed tip
+    int chaseBubbleBurst = 40;        // bubbles released when a shark starts chasing
+    int maxRipples = 64;              // oldest ripple is recycled once this many are live
+    int sharkDecisionInterval = 4;    // ticks between shark state/target decisions
+    int fishDecisionInterval = 3;     // ticks between fish flocking scans
+    double aiBudgetMs = 2.0;          // per-tick time budget for each scheduler
+    bool pipelined = true;            // simulate on a worker thread while the GL thread draws
+    std::string renderer = "auto";    // auto, core, legacy, null or record
+    bool recordStats = false;         // wrap the chosen backend in a RecordingRenderer
+    std::string commandDump;          // file that receives the recorded command stream
+    int dumpFrames = 1;               // number of frames written to commandDump
+    bool headless = false;            // no window; simulate and submit to a non-GL backend
+    int frames = 600;                 // frames to run in headless mode
+    int fishCount = 35;               // also the fish pool capacity
+    int sharkCount = 3;
+    int crabCount = 8;
+    float fishRespawnSeconds = 4.0f;  // delay before an eaten fish is replaced
+    float sharkHungerRate = 0.001f;   // hunger lost per tick; eating restores 0.2
+    float fleeRadius = 0.3f;          // prey flees from its nearest predator within this
+    float eatRadius = 0.12f;          // and is eaten within this
+    bool passTiming = false;          // time each render pass on the CPU and, with a GL context, the GPU
+    int qualityTier = 0;              // starting tier, 0 (high) to 3 (minimal)
+    double targetFrameMs = 16.6;      // CPU submit plus GPU time per frame the quality governor holds; 0 fixes the tier
+    float timeScale = 1.0f;           // animation and simulation speed
+    double fixedStepMs = 0.0;         // advance animation by exactly this per frame; headless defaults to 16
+    std::string trajectoryPath;       // columnar per-tick recording, read with trajectory_reader
+    int trajectoryEvery = 1;          // record every Nth tick
+    int trajectoryBufferMb = 64;      // queued data beyond this is dropped instead of stalling the tick
+    unsigned seed = 0;                // simulation seed; 0 picks one from the clock
+    std::string recordInputPath;      // journal every applied input with its tick
+    std::string replayInputPath;      // feed a journal back at the recorded ticks instead of live input
+    bool batch = false;               // step many windowless worlds in parallel and report on each
+    std::vector<std::string> sweeps;  // "option=v1,v2,..."; the batch runs every combination
+    int batchSeeds = 1;               // worlds per sweep point, seeded consecutively
+    int batchTicks = 3600;            // ticks each batch world runs
+    int batchThreads = 0;             // 0 uses every hardware thread
+    int worldgenThreads = 0;          // threads rolling a new world's creatures; 0 uses every hardware thread
+    double firstFrameTargetMs = 250.0; // launch-to-first-frame budget the startup report checks
+    std::string serveAddress;         // simulate headless and stream to clients: "[host:]port" or "unix:PATH"
+    std::string connectAddress;       // draw the world streamed by a --serve process instead of simulating
+    int serveTicks = 0;               // ticks to serve before exiting; 0 serves until killed
+    bool verbose = false;             // per-crab trace lines; always on in the window
+};
+Config config;
+
+int worldgenThreadCount(const Config& settings) {
+    int threads = settings.worldgenThreads > 0 ? settings.worldgenThreads : (int)std::thread::hardware_concurrency();
+    return std::max(1, threads);
+}
+
+// Bubble particles live in fixed-capacity parallel arrays so updates stay
+// contiguous and the whole pool can be drawn with a single glDrawArrays.
+struct BubblePool {
+    std::vector<float> x, y, radius, rise;
+    std::vector<uint32_t> id;   // stays with a bubble when it moves slot
+    int count = 0;
+    int capacity = 0;
+    uint32_t nextId = 0;
+};
+
+struct BubbleEmitter {
+    float x, y;
+    float spread;       // half-width of the spawn area along x
+    float rate;         // bubbles per second
+    float accumulator;
+};
+
+// Everything display() needs from one simulation tick. The simulation writes
+// these and the GL thread only ever reads a published copy.
+struct CreatureInstance {
+    float x, y, scale;
+    float r, g, b;
+    bool facingRight;
+    EntityHandle id;
+};
+
+struct BubbleInstance {
+    float x, y, radius;
+};
+
+struct RenderSnapshot {
+    long tick = 0;
+    std::vector<CreatureInstance> fish, sharks, crabs;
+    std::vector<BubbleInstance> bubbles;
+    std::vector<Ripple> ripples;     // oldest first, except as patched by a net client
+    std::vector<Food> food;
+    std::vector<Rock> rocks;
+    std::vector<Seaweed> seaweeds;
+    bool perspective = false;
+};
+
+// Lock-free triple buffer: the simulation fills one slot while the GL thread
+// reads another; the third holds the latest complete snapshot. The high bit
+// of `latest` marks a snapshot the reader has not picked up yet.
+struct SnapshotBuffer {
+    RenderSnapshot slots[3];
+    std::atomic<int> latest{ 1 };
+    int writing = 0;
+    int reading = 2;
+};
+
+// Input that changes simulation state is queued from GLUT callbacks and
+// applied by the simulation at the start of its next tick.
+struct InputEvent {
+    enum class Type { AddFood, Reset, ToggleProjection };
+    Type type;
+    float x, y;
+};
+
+// Every input is applied at a tick boundary, so a list of (tick, event)
+// pairs plus the world's seed is enough to reproduce a session exactly.
+struct JournalEntry {
+    long tick;
+    InputEvent event;
+};
+
+struct InputJournal {
+    FILE* recordFile = nullptr;
+    std::vector<JournalEntry> replay;   // in tick order
+    size_t next = 0;                    // first entry not yet replayed
+    bool replaying = false;
+};
+
+// Sweep-and-prune state for predation, kept between ticks
+struct SweepAndPrune {
+    std::vector<uint32_t> hunters;  // predator rows sorted by x
+    std::vector<float> hunterX;     // their x, packed in the same order
+    long candidates = 0;            // pairs tested over the whole run
+};
+
+// Everything one simulated tank owns. The window shows `tank`; the batch
+// runner steps many worlds at once, each on one thread at a time, so the
+// simulation must not touch anything outside its world.
+struct World {
+    Config config;                           // this world's tunables
+    std::minstd_rand rng;                    // the only randomness the simulation uses
+    long tick = 0;
+    FishArchetype fishes;
+    SharkArchetype sharks;
+    CrabArchetype crabs;
+    std::vector<EntityHandle> eatenFish;     // scratch for updateFish, sized to the pool
+    std::vector<long> fishRespawnTicks;      // tick at which each eaten fish comes back
+    AIScheduler sharkScheduler = { 4, 2.0 };
+    AIScheduler fishScheduler = { 3, 2.0 };
+    SweepAndPrune predationBroadphase;
+    BubblePool bubbles;
+    std::vector<BubbleEmitter> bubbleEmitters;
+    std::vector<Food> foodList;
+    std::vector<uint32_t> foodIds;           // per pellet, kept in step with foodList
+    uint32_t nextFoodId = 0;
+    std::vector<Rock> rocks;
+    std::vector<Seaweed> seaweeds;
+    FlowField flow;                          // steering toward food and away from rocks
+    RippleRing ripples;
+    long fishEaten = 0;
+    bool verbose = false;                    // per-crab trace output
+};
+World tank;
+// Renderer-facing vocabulary shared by every backend
+enum class Primitive { Points, Lines, LineLoop, Triangles, TriangleStrip, TriangleFan, Quads };
+enum class Mesh { FishBody, SharkBody, Seaweed, FishTail, FishFins, SharkBelly, SharkFins, CrabLegs, GrassBlade,
+                  Sphere6, Sphere8, Sphere10, Sphere12, Sphere15, Count };
+
+struct VertexArrays {
+    int positionSize;          // 2 or 3 floats per vertex
+    const float* positions;
+    const float* colors;       // optional RGBA per vertex
+    const float* texCoords;    // optional UV per vertex
+};
+
+GLuint bubbleTexture = 0;
+std::vector<GLfloat> bubbleVertices, bubbleTexCoords;
+std::vector<GLfloat> rippleVertices, rippleColors;
+std::deque<CircleTable> circleTables;  // deque keeps returned references stable
+bool usePerspective = false;         // projection the GL thread last set
+
+SnapshotBuffer snapshots;
+std::mutex inputMutex;
+std::vector<InputEvent> pendingInput;
+InputJournal inputJournal;
+bool perspectiveView = false;        // simulation-side state toggled by 'p'
+std::thread simThread;
+std::atomic<bool> simRunning{ false };
+std::thread worldThread;
+std::atomic<bool> worldReady{ true };    // false while worldThread is still generating the tank
+
+// Launch timing, printed with the first frame. Each phase runs from the end
+// of the previous one; world generation runs beside them on worldThread and
+// reports on its own.
+struct StartupReport {
+    std::chrono::steady_clock::time_point launch = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point phaseStart = launch;
+    std::string phases;
+    bool reported = false;
+
+    double sinceLaunch() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launch).count();
+    }
+
+    void phase(const char* name) {
+        auto now = std::chrono::steady_clock::now();
+        char text[64];
+        snprintf(text, sizeof(text), "%s%s %.1f ms", phases.empty() ? "" : ", ", name,
+                 std::chrono::duration<double, std::milli>(now - phaseStart).count());
+        phases += text;
+        phaseStart = now;
+    }
+
+    void firstFrame(double targetMs) {
+        if (reported) return;
+        reported = true;
+        double ms = sinceLaunch();
+        std::cout << "Startup: " << phases << "; first frame " << ms << " ms after launch";
+        if (targetMs > 0.0) {
+            std::cout << (ms <= targetMs ? ", within the " : ", over the ") << targetMs << " ms target";
+        }
+        std::cout << std::endl;
+    }
+};
+StartupReport startup;
+
+bool haveGLContext = false;
+
+void checkGLError(const char* operation) {
+    if (!haveGLContext) return;
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        std::cerr << "OpenGL Error after " << operation << ": " << gluErrorString(error) << std::endl;
+    }
+}
+
+// Animation time for one frame. renderFrame() samples the clock once and
+// hands this to every draw helper, so all motion in a frame shares one phase.
+struct FrameTime {
+    double millis;      // animation clock
+    double deltaMillis; // animation time since the previous frame
+};
+
+// Drives animation, and the simulation's tick rate, from wall time scaled
+// by `scale`, or by exactly fixedStepMillis per frame for offline rendering.
+// Paused and scale are read by the simulation thread as well.
+struct AnimationClock {
+    double millis = 0.0;
+    double fixedStepMillis = 0.0;   // > 0 ignores wall time
+    std::atomic<bool> paused{ false };
+    std::atomic<float> scale{ 1.0f };
+    std::chrono::steady_clock::time_point last;
+    bool started = false;
+};
+AnimationClock animationClock;
+
+FrameTime advanceAnimationClock() {
+    auto now = std::chrono::steady_clock::now();
+    double wall = animationClock.started ? std::chrono::duration<double, std::milli>(now - animationClock.last).count() : 0.0;
+    animationClock.last = now;
+    animationClock.started = true;
+
+    double delta = 0.0;
+    if (!animationClock.paused) {
+        delta = animationClock.fixedStepMillis > 0.0 ? animationClock.fixedStepMillis : wall * animationClock.scale;
+    }
+    animationClock.millis += delta;
+    return { animationClock.millis, delta };
+}
+
+const CircleTable& circleTable(int segments) {
+    for (const auto& table : circleTables) {
+        if (table.segments == segments) return table;
+    }
+    CircleTable table;
+    table.segments = segments;
+    table.cosTable.resize(segments + 1);
+    table.sinTable.resize(segments + 1);
+    for (int i = 0; i < segments; ++i) {
+        float angle = i * 2.0f * 3.1416f / segments;
+        table.cosTable[i] = cosf(angle);
+        table.sinTable[i] = sinf(angle);
+    }
+    table.cosTable[segments] = table.cosTable[0];
+    table.sinTable[segments] = table.sinTable[0];
+    circleTables.push_back(table);
+    return circleTables.back();
+}
+
+// Column-major 4x4 matrix, laid out like OpenGL's own matrices
+struct Mat4 {
+    float m[16];
+};
+
+Mat4 mat4Identity() {
+    Mat4 r = {};
+    r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+    return r;
+}
+
+Mat4 mat4Multiply(const Mat4& a, const Mat4& b) {
+    Mat4 r;
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += a.m[k * 4 + row] * b.m[col * 4 + k];
+            }
+            r.m[col * 4 + row] = sum;
+        }
+    }
+    return r;
+}
+
+Mat4 mat4Translate(float x, float y, float z) {
+    Mat4 r = mat4Identity();
+    r.m[12] = x;
+    r.m[13] = y;
+    r.m[14] = z;
+    return r;
+}
+
+Mat4 mat4Scale(float x, float y, float z) {
+    Mat4 r = mat4Identity();
+    r.m[0] = x;
+    r.m[5] = y;
+    r.m[10] = z;
+    return r;
+}
+
+// Same convention as glRotatef: angle in degrees around an arbitrary axis
+Mat4 mat4Rotate(float degrees, float x, float y, float z) {
+    float len = sqrtf(x * x + y * y + z * z);
+    if (len == 0.0f) return mat4Identity();
+    x /= len; y /= len; z /= len;
+    float rad = degrees * 3.14159265f / 180.0f;
+    float c = cosf(rad), s = sinf(rad), ic = 1.0f - c;
+    Mat4 r = mat4Identity();
+    r.m[0] = x * x * ic + c;     r.m[4] = x * y * ic - z * s; r.m[8] = x * z * ic + y * s;
+    r.m[1] = y * x * ic + z * s; r.m[5] = y * y * ic + c;     r.m[9] = y * z * ic - x * s;
+    r.m[2] = x * z * ic - y * s; r.m[6] = y * z * ic + x * s; r.m[10] = z * z * ic + c;
+    return r;
+}
+
+Mat4 mat4Ortho(float left, float right, float bottom, float top, float nearZ, float farZ) {
+    Mat4 r = mat4Identity();
+    r.m[0] = 2.0f / (right - left);
+    r.m[5] = 2.0f / (top - bottom);
+    r.m[10] = -2.0f / (farZ - nearZ);
+    r.m[12] = -(right + left) / (right - left);
+    r.m[13] = -(top + bottom) / (top - bottom);
+    r.m[14] = -(farZ + nearZ) / (farZ - nearZ);
+    return r;
+}
+
+Mat4 mat4Perspective(float fovyDegrees, float aspect, float nearZ, float farZ) {
+    float f = 1.0f / tanf(fovyDegrees * 3.14159265f / 360.0f);
+    Mat4 r = {};
+    r.m[0] = f / aspect;
+    r.m[5] = f;
+    r.m[10] = (farZ + nearZ) / (nearZ - farZ);
+    r.m[11] = -1.0f;
+    r.m[14] = 2.0f * farZ * nearZ / (nearZ - farZ);
+    return r;
+}
+
+// Inverse transpose of the upper 3x3, i.e. what fixed function applies to normals
+void mat4NormalMatrix(const Mat4& a, float out[9]) {
+    const float* m = a.m;
+    float c00 = m[5] * m[10] - m[9] * m[6];
+    float c01 = m[8] * m[6] - m[4] * m[10];
+    float c02 = m[4] * m[9] - m[8] * m[5];
+    float c10 = m[9] * m[2] - m[1] * m[10];
+    float c11 = m[0] * m[10] - m[8] * m[2];
+    float c12 = m[8] * m[1] - m[0] * m[9];
+    float c20 = m[1] * m[6] - m[5] * m[2];
+    float c21 = m[4] * m[2] - m[0] * m[6];
+    float c22 = m[0] * m[5] - m[4] * m[1];
+    float det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    float inv = det != 0.0f ? 1.0f / det : 0.0f;
+    // Column-major cofactor matrix divided by the determinant
+    out[0] = c00 * inv; out[3] = c01 * inv; out[6] = c02 * inv;
+    out[1] = c10 * inv; out[4] = c11 * inv; out[7] = c12 * inv;
+    out[2] = c20 * inv; out[5] = c21 * inv; out[8] = c22 * inv;
+}
+
+// Static geometry shared by every backend: interleaved position and normal,
+// three floats each, and an index list drawn as GL_TRIANGLES. The builders
+// emit one vertex per triangle corner and indexMesh() then merges them.
+// Animated meshes never change
+// their vertices; at animation time t (ms) and instance phase a vertex is
+// drawn at
+//   position + sway * sin(t * swayRate + phase) + drift * sin(t * driftRate + phase)
+// where sway is its own peak displacement and drift moves the whole mesh.
+// Every sway and drift rate is a whole multiple of meshRateStep, so all of
+// them repeat after meshPeriodMs and the clock the meshes see can wrap there
+// instead of growing until a float can no longer resolve a frame
+const double meshRateStep = 0.0005;
+const double meshPeriodMs = 2.0 * 3.14159265358979 / meshRateStep;
+
+struct MeshData {
+    std::vector<float> vertices;
+    std::vector<uint16_t> indices;
+    std::vector<float> sway;        // three floats per vertex, empty if nothing sways
+    float swayRate = 0.0f;          // radians per millisecond, a multiple of meshRateStep
+    float driftRate = 0.0f;
+    float drift[3] = {};
+
+    bool animated() const { return !sway.empty() || driftRate != 0.0f; }
+};
+
+std::vector<MeshData> meshes((size_t)Mesh::Count);
+
+void addMeshVertex(MeshData& mesh, float x, float y, float z, float nx, float ny, float nz) {
+    float v[6] = { x, y, z, nx, ny, nz };
+    mesh.vertices.insert(mesh.vertices.end(), v, v + 6);
+}
+
+// Unit sphere around the z axis, the same layout glutSolidSphere produces
+MeshData buildSphereMesh(int slices, int stacks) {
+    MeshData mesh;
+    const CircleTable& ring = circleTable(slices);
+    const CircleTable& half = circleTable(stacks * 2);
+    for (int i = 0; i < stacks; ++i) {
+        float z0 = half.cosTable[i], r0 = half.sinTable[i];
+        float z1 = half.cosTable[i + 1], r1 = half.sinTable[i + 1];
+        for (int j = 0; j < slices; ++j) {
+            float c0 = ring.cosTable[j], s0 = ring.sinTable[j];
+            float c1 = ring.cosTable[j + 1], s1 = ring.sinTable[j + 1];
+            float p[4][3] = {
+                { c0 * r0, s0 * r0, z0 }, { c0 * r1, s0 * r1, z1 },
+                { c1 * r1, s1 * r1, z1 }, { c1 * r0, s1 * r0, z0 }
+            };
+            const int order[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k : order) {
+                addMeshVertex(mesh, p[k][0], p[k][1], p[k][2], p[k][0], p[k][1], p[k][2]);
+            }
+        }
+    }
+    return mesh;
+}
+
+// Emits one quad as two triangles
+void addMeshQuad(MeshData& mesh, const float p[4][3], const float n[4][3]) {
+    const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int k : order) {
+        addMeshVertex(mesh, p[k][0], p[k][1], p[k][2], n[k][0], n[k][1], n[k][2]);
+    }
+}
+
+// Flat convex polygon of an animated mesh, as a fan from its first corner.
+// Corner k sways by sway[k].
+void addSwayPolygon(MeshData& mesh, int count, const float p[][3], const float sway[][3], const float n[3]) {
+    for (int k = 1; k + 1 < count; ++k) {
+        const int corners[3] = { 0, k, k + 1 };
+        for (int c : corners) {
+            addMeshVertex(mesh, p[c][0], p[c][1], p[c][2], n[0], n[1], n[2]);
+            mesh.sway.insert(mesh.sway.end(), sway[c], sway[c] + 3);
+        }
+    }
+}
+
+// Greedy triangle reordering for the post-transform vertex cache, after
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Each step emits
+// the triangle whose corners score highest: vertices used very recently
+// score high, and so do vertices with few triangles left, so they can
+// leave the cache for good.
+void optimizeVertexCache(std::vector<uint16_t>& indices, size_t vertexCount) {
+    const int cacheSize = 32;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // Triangles still to be emitted that use each vertex, packed per vertex
+    std::vector<uint32_t> first(vertexCount + 1, 0), live(vertexCount);
+    for (uint16_t v : indices) ++first[v + 1];
+    for (size_t v = 0; v < vertexCount; ++v) {
+        live[v] = first[v + 1];
+        first[v + 1] += first[v];
+    }
+    std::vector<uint32_t> triangles(indices.size());
+    std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+    for (size_t k = 0; k < indices.size(); ++k) {
+        triangles[fill[indices[k]]++] = (uint32_t)(k / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    auto score = [&](size_t v) {
+        if (live[v] == 0) return -1.0f;
+        float s = 0.0f;
+        int position = cachePosition[v];
+        if (position >= 0) {
+            // The last triangle's corners get a fixed score so the next one
+            // does not just reuse the same edge
+            s = position < 3 ? 0.75f : powf(1.0f - (position - 3) / float(cacheSize - 3), 1.5f);
+        }
+        return s + 2.0f / sqrtf((float)live[v]);
+    };
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = score(v);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<uint16_t> ordered;
+    ordered.reserve(indices.size());
+    std::vector<uint16_t> cache, nextCache;
+    size_t best = SIZE_MAX;
+    while (ordered.size() < indices.size()) {
+        if (best == SIZE_MAX) {
+            // Nothing in the cache touches a triangle that is left, so start
+            // again from the best one anywhere
+            float bestScore = -1.0f;
+            for (size_t t = 0; t < triangleCount; ++t) {
+                if (!emitted[t] && triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        emitted[best] = true;
+        const uint16_t* corner = &indices[best * 3];
+        nextCache.assign(corner, corner + 3);
+        for (int k = 0; k < 3; ++k) {
+            uint16_t v = corner[k];
+            ordered.push_back(v);
+            uint32_t* list = &triangles[first[v]];
+            uint32_t* end = list + live[v];
+            std::swap(*std::find(list, end, (uint32_t)best), end[-1]);
+            --live[v];
+        }
+        for (uint16_t v : cache) {
+            if (v != corner[0] && v != corner[1] && v != corner[2]) nextCache.push_back(v);
+        }
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            uint16_t v = nextCache[i];
+            cachePosition[v] = i < (size_t)cacheSize ? (int)i : -1;
+            vertexScore[v] = score(v);
+        }
+        // Only triangles around vertices whose score moved can change
+        best = SIZE_MAX;
+        float bestScore = -1.0f;
+        for (uint16_t v : nextCache) {
+            for (uint32_t i = first[v]; i < first[v] + live[v]; ++i) {
+                uint32_t t = triangles[i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > (size_t)cacheSize) nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+    }
+    indices.swap(ordered);
+}
+
+// Turns the per-corner vertices a builder emitted into an indexed mesh:
+// identical corners are merged, triangles that collapsed to a line (at the
+// poles of the spheres) are dropped, triangles are ordered for the vertex
+// cache and vertices are laid out in the order that order first reads them.
+void indexMesh(MeshData& mesh) {
+    if (!mesh.indices.empty()) return;
+    size_t corners = mesh.vertices.size() / 6;
+    bool swaying = !mesh.sway.empty();
+    auto key = [&](size_t c, int k) { return k < 6 ? mesh.vertices[c * 6 + k] : swaying ? mesh.sway[c * 3 + k - 6] : 0.0f; };
+    auto less = [&](size_t a, size_t b) {
+        for (int k = 0; k < 9; ++k) {
+            if (key(a, k) != key(b, k)) return key(a, k) < key(b, k);
+        }
+        return false;
+    };
+    std::vector<size_t> sorted(corners);
+    for (size_t c = 0; c < corners; ++c) sorted[c] = c;
+    std::stable_sort(sorted.begin(), sorted.end(), less);
+    std::vector<uint32_t> merged(corners);
+    uint32_t unique = 0;
+    for (size_t i = 0; i < corners; ++i) {
+        if (i > 0 && less(sorted[i - 1], sorted[i])) ++unique;
+        merged[sorted[i]] = unique;
+    }
+    size_t vertexCount = corners > 0 ? unique + 1 : 0;
+    if (vertexCount > 65536) {
+        std::cerr << "Mesh has " << vertexCount << " vertices, more than 16-bit indices reach" << std::endl;
+        exit(1);
+    }
+
+    std::vector<uint16_t> indices;
+    for (size_t c = 0; c + 2 < corners; c += 3) {
+        uint32_t a = merged[c], b = merged[c + 1], d = merged[c + 2];
+        if (a == b || b == d || a == d) continue;
+        indices.push_back((uint16_t)a);
+        indices.push_back((uint16_t)b);
+        indices.push_back((uint16_t)d);
+    }
+    optimizeVertexCache(indices, vertexCount);
+
+    std::vector<size_t> source(vertexCount);
+    for (size_t c = 0; c < corners; ++c) source[merged[c]] = c;
+    std::vector<int> remap(vertexCount, -1);
+    std::vector<float> vertices, sway;
+    for (uint16_t& index : indices) {
+        if (remap[index] < 0) {
+            size_t c = source[index];
+            remap[index] = (int)(vertices.size() / 6);
+            vertices.insert(vertices.end(), &mesh.vertices[c * 6], &mesh.vertices[c * 6] + 6);
+            if (swaying) sway.insert(sway.end(), &mesh.sway[c * 3], &mesh.sway[c * 3] + 3);
+        }
+        index = (uint16_t)remap[index];
+    }
+    mesh.vertices.swap(vertices);
+    mesh.sway.swap(sway);
+    mesh.indices.swap(indices);
+}
+
+// Fins, tails and legs, built at their rest pose. The sway amplitudes and
+// rates are the ones the draw code used to apply per vertex on the CPU.
+void buildAnimatedMeshes() {
+    // Fish parts are in units of the fish's scale, so the tail swing of
+    // 0.02 at an average scale of 0.4 becomes 0.05
+    MeshData& tail = meshes[(size_t)Mesh::FishTail];
+    tail = MeshData();
+    tail.swayRate = 0.005f;
+    {
+        const float p[3][3] = { { -0.07f, 0.0f, 0.0f }, { -0.11f, 0.04f, 0.0f }, { -0.11f, -0.04f, 0.0f } };
+        const float s[3][3] = { { 0, 0, 0 }, { 0, 0.05f, 0 }, { 0, -0.05f, 0 } };
+        const float n[3] = { -1.0f, 0.0f, 0.0f };
+        addSwayPolygon(tail, 3, p, s, n);
+    }
+    MeshData& fins = meshes[(size_t)Mesh::FishFins];
+    fins = MeshData();
+    fins.swayRate = 0.005f;
+    {
+        const float p[3][3] = { { -0.02f, 0.035f, 0.0f }, { 0.01f, 0.06f, 0.0f }, { 0.04f, 0.035f, 0.0f } };
+        const float s[3][3] = { { 0, 0, 0 }, { 0, 0.025f, 0 }, { 0, 0, 0 } };
+        const float n[3] = { 0.0f, 1.0f, 0.0f };
+        addSwayPolygon(fins, 3, p, s, n);
+    }
+    {
+        const float p[3][3] = { { 0.02f, 0.0f, 0.0f }, { 0.05f, 0.015f, 0.0f }, { 0.05f, -0.015f, 0.0f } };
+        const float s[3][3] = { { 0, 0, 0 }, { 0, 0.025f, 0 }, { 0, -0.025f, 0 } };
+        const float n[3] = { 0.0f, 0.0f, 1.0f };
+        addSwayPolygon(fins, 3, p, s, n);
+    }
+
+    // The shark's body, belly and fins bob together; fin tips and the tail
+    // beat on a second, faster wave
+    meshes[(size_t)Mesh::SharkBody].driftRate = 0.003f;
+    meshes[(size_t)Mesh::SharkBody].drift[1] = 0.05f;
+    MeshData& belly = meshes[(size_t)Mesh::SharkBelly];
+    belly = MeshData();
+    belly.driftRate = 0.003f;
+    belly.drift[1] = 0.05f;
+    for (int i = 0; i < 10; ++i) {
+        float t = i / 10.0f;
+        float tNext = (i + 1) / 10.0f;
+        float yScale = (t < 0.2f) ? (0.1f + 0.5f * t) : (0.2f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
+        float x0 = -0.5f + t * 0.9f;
+        float x1 = -0.5f + tNext * 0.9f;
+        const float p[4][3] = { { x0, -yScale, -0.05f }, { x1, -yScale, -0.05f }, { x1, -yScale, 0.05f }, { x0, -yScale, 0.05f } };
+        const float s[4][3] = {};
+        const float n[3] = { 0.0f, -1.0f, 0.0f };
+        addSwayPolygon(belly, 4, p, s, n);
+    }
+    MeshData& sharkFins = meshes[(size_t)Mesh::SharkFins];
+    sharkFins = MeshData();
+    sharkFins.swayRate = 0.005f;
+    sharkFins.driftRate = 0.003f;
+    sharkFins.drift[1] = 0.05f;
+    {
+        const float n[3] = { 0.0f, 0.0f, 1.0f };
+        const float dorsal[3][3] = { { 0.0f, 0.2f, 0.0f }, { 0.2f, 0.5f, 0.05f }, { 0.3f, 0.2f, 0.05f } };
+        const float dorsalSway[3][3] = { { 0, 0, 0 }, { 0, 0.05f, 0 }, { 0, 0, 0 } };
+        addSwayPolygon(sharkFins, 3, dorsal, dorsalSway, n);
+        const float lower[3][3] = { { 0.1f, 0.0f, 0.0f }, { 0.3f, -0.2f, 0.1f }, { 0.05f, -0.1f, 0.05f } };
+        const float lowerSway[3][3] = { { 0, 0, 0 }, { 0, -0.05f, 0 }, { 0, 0, 0 } };
+        addSwayPolygon(sharkFins, 3, lower, lowerSway, n);
+        const float upper[3][3] = { { 0.1f, 0.0f, 0.0f }, { 0.3f, 0.2f, -0.1f }, { 0.05f, 0.1f, -0.05f } };
+        const float upperSway[3][3] = { { 0, 0, 0 }, { 0, 0.05f, 0 }, { 0, 0, 0 } };
+        addSwayPolygon(sharkFins, 3, upper, upperSway, n);
+    }
+    {
+        // The tail used to turn up to one degree about its root at x = 0.4;
+        // for so small an angle that is a sideways push of the tips
+        const float angle = 0.05f * 20.0f * 3.14159265f / 180.0f;
+        const float p[3][3] = { { 0.4f, 0.0f, 0.0f }, { 0.6f, 0.25f, 0.05f }, { 0.6f, -0.25f, 0.05f } };
+        const float s[3][3] = { { 0, 0, 0 }, { 0.05f * angle, 0, -0.2f * angle }, { 0.05f * angle, 0, -0.2f * angle } };
+        const float n[3] = { -1.0f, 0.0f, 0.0f };
+        addSwayPolygon(sharkFins, 3, p, s, n);
+    }
+
+    // Four crab legs around the shell, tips lifting and dropping in turn
+    MeshData& legs = meshes[(size_t)Mesh::CrabLegs];
+    legs = MeshData();
+    legs.swayRate = 0.01f;
+    const float legRoots[4] = { 0.04f, 0.02f, -0.04f, -0.02f };
+    const float legReach[4][2] = { { 0.04f, 0.02f }, { 0.04f, -0.02f }, { -0.04f, 0.02f }, { -0.04f, -0.02f } };
+    for (int i = 0; i < 4; ++i) {
+        float x = legRoots[i], dx = legReach[i][0], dy = legReach[i][1];
+        float lift = dy > 0.0f ? 0.015f : -0.015f;
+        const float p[4][3] = {
+            { x, 0.0f, 0.025f }, { x + dx, dy, 0.025f }, { x + dx, dy, 0.017f }, { x, 0.0f, 0.017f }
+        };
+        const float s[4][3] = { { 0, 0, 0 }, { 0, lift, 0 }, { 0, lift, 0 }, { 0, 0, 0 } };
+        const float n[3] = { 0.0f, 0.0f, 1.0f };
+        addSwayPolygon(legs, 4, p, s, n);
+    }
+
+    // One unit-tall grass blade whose tip swings sideways; seaweed strands
+    // drift as a whole
+    MeshData& blade = meshes[(size_t)Mesh::GrassBlade];
+    blade = MeshData();
+    blade.swayRate = 0.002f;
+    {
+        const float p[4][3] = { { 0.0f, 0.0f, 0.0f }, { 0.005f, 0.0f, 0.0f }, { 0.005f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+        const float s[4][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0.02f, 0, 0 }, { 0.02f, 0, 0 } };
+        const float n[3] = { 0.0f, 0.0f, 1.0f };
+        addSwayPolygon(blade, 4, p, s, n);
+    }
+    meshes[(size_t)Mesh::Seaweed].driftRate = 0.0015f;
+    meshes[(size_t)Mesh::Seaweed].drift[0] = 0.05f;
+}
+
+void buildMeshes() {
+    // theta spans half a turn, so every other entry of the 40-segment table
+    // gives the 20 latitude steps while the 20-segment table gives longitude
+    const CircleTable& ring = circleTable(20);
+    const CircleTable& half = circleTable(40);
+    MeshData& fish = meshes[(size_t)Mesh::FishBody];
+    fish = MeshData();
+    for (int i = 0; i < 20; ++i) {
+        float sinTheta = half.sinTable[i], cosTheta = half.cosTable[i];
+        float sinThetaNext = half.sinTable[i + 1], cosThetaNext = half.cosTable[i + 1];
+        for (int j = 0; j < 20; ++j) {
+            float cosPhi = ring.cosTable[j], sinPhi = ring.sinTable[j];
+            float cosPhiNext = ring.cosTable[j + 1], sinPhiNext = ring.sinTable[j + 1];
+            float p[4][3] = {
+                { cosPhi * sinTheta, cosTheta, sinPhi * sinTheta },
+                { cosPhiNext * sinTheta, cosTheta, sinPhiNext * sinTheta },
+                { cosPhiNext * sinThetaNext, cosThetaNext, sinPhiNext * sinThetaNext },
+                { cosPhi * sinThetaNext, cosThetaNext, sinPhi * sinThetaNext }
+            };
+            addMeshQuad(fish, p, p);
+        }
+    }
+
+    MeshData& shark = meshes[(size_t)Mesh::SharkBody];
+    shark = MeshData();
+    for (int i = 0; i < 30; ++i) {
+        float t = i / 30.0f;
+        float tNext = (i + 1) / 30.0f;
+        float yScale = (t < 0.2f) ? (0.1f + 0.5f * t) : (0.2f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
+        float zScale = (t < 0.2f) ? (0.08f + 0.35f * t) : (0.15f * (1.0f - 0.5f * (t - 0.5f) * (t - 0.5f)));
+        for (int j = 0; j < 20; ++j) {
+            float cosPhi = ring.cosTable[j], sinPhi = ring.sinTable[j];
+            float cosPhiNext = ring.cosTable[j + 1], sinPhiNext = ring.sinTable[j + 1];
+            float x0 = -0.5f + t * 0.9f;
+            float x1 = -0.5f + tNext * 0.9f;
+            float p[4][3] = {
+                { x0, yScale * cosPhi, zScale * sinPhi },
+                { x0, yScale * cosPhiNext, zScale * sinPhiNext },
+                { x1, yScale * cosPhiNext, zScale * sinPhiNext },
+                { x1, yScale * cosPhi, zScale * sinPhi }
+            };
+            // One normal per quad, as the original display list had it
+            float nx = cosPhi / yScale;
+            float ny = sinPhi / yScale;
+            float nz = sinPhi / zScale;
+            float n[4][3] = { { nx, ny, nz }, { nx, ny, nz }, { nx, ny, nz }, { nx, ny, nz } };
+            addMeshQuad(shark, p, n);
+        }
+    }
+    // Gill slits
+    const float gillNormal[4][3] = { { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
+    for (int i = 0; i < 3; ++i) {
+        float x = -0.5f + i * 0.03f;
+        float front[4][3] = {
+            { x, 0.05f, 0.08f }, { x + 0.01f, 0.05f, 0.08f },
+            { x + 0.01f, -0.05f, 0.08f }, { x, -0.05f, 0.08f }
+        };
+        float back[4][3] = {
+            { x, 0.05f, -0.08f }, { x + 0.01f, 0.05f, -0.08f },
+            { x + 0.01f, -0.05f, -0.08f }, { x, -0.05f, -0.08f }
+        };
+        addMeshQuad(shark, front, gillNormal);
+        addMeshQuad(shark, back, gillNormal);
+    }
+
+    MeshData& seaweed = meshes[(size_t)Mesh::Seaweed];
+    seaweed = MeshData();
+    for (int i = 0; i < 5; ++i) {
+        float t = i / 5.0f, tNext = (i + 1) / 5.0f;
+        float width = 0.02f * (1.0f - t), widthNext = 0.02f * (1.0f - tNext);
+        float p[4][3] = {
+            { -width, t, 0.0f }, { width, t, 0.0f },
+            { widthNext, tNext, 0.0f }, { -widthNext, tNext, 0.0f }
+        };
+        addMeshQuad(seaweed, p, gillNormal);
+    }
+
+    meshes[(size_t)Mesh::Sphere6] = buildSphereMesh(6, 6);
+    meshes[(size_t)Mesh::Sphere8] = buildSphereMesh(8, 8);
+    meshes[(size_t)Mesh::Sphere10] = buildSphereMesh(10, 10);
+    meshes[(size_t)Mesh::Sphere12] = buildSphereMesh(12, 12);
+    meshes[(size_t)Mesh::Sphere15] = buildSphereMesh(15, 15);
+    buildAnimatedMeshes();
+    for (auto& mesh : meshes) {
+        indexMesh(mesh);
+    }
+}
+
+// Everything the draw helpers submit goes through this interface, so the
+// same scene code can target fixed function or the core profile.
+class Renderer {
+public:
+    virtual ~Renderer() {}
+    virtual const char* name() const = 0;
+    virtual bool init() = 0;
+    virtual void beginFrame() {}
+    virtual void endFrame() {}
+    virtual GLuint createTexture(int width, int height, const GLubyte* rgba) = 0;
+
+    virtual void setProjection(bool perspective, int width, int height) = 0;
+    virtual void clear(float r, float g, float b, float a) = 0;
+    virtual void pushMatrix() = 0;
+    virtual void popMatrix() = 0;
+    virtual void translate(float x, float y, float z) = 0;
+    virtual void scale(float x, float y, float z) = 0;
+    virtual void rotate(float degrees, float x, float y, float z) = 0;
+
+    virtual void setLight(int index, const float position[4], const float ambient[4],
+                          const float diffuse[4], const float specular[4]) = 0;
+    virtual void setLightPosition(int index, const float position[4]) = 0;
+    virtual void setDiffuse(const float diffuse[4]) = 0;
+    virtual void setSpecular(const float specular[4]) = 0;
+    virtual void setShininess(float shininess) = 0;
+    virtual void setLighting(bool enabled) = 0;
+    virtual void setBlending(bool enabled) = 0;
+    virtual void setDepthTest(bool enabled) = 0;
+    virtual void setDepthWrite(bool enabled) = 0;
+    virtual void setTexture(GLuint texture) = 0;
+    virtual void setAlphaTest(bool enabled, float ref) = 0;
+    virtual void setPointSize(float size) = 0;
+
+    // Immediate-style submission for small dynamic shapes
+    virtual void begin(Primitive primitive) = 0;
+    virtual void color(float r, float g, float b, float a) = 0;
+    virtual void normal(float x, float y, float z) = 0;
+    virtual void vertex(float x, float y, float z = 0.0f) = 0;
+    virtual void end() = 0;
+
+    virtual void drawArrays(Primitive primitive, int count, const VertexArrays& arrays) = 0;
+    virtual void drawMesh(Mesh mesh) = 0;
+
+    // Clock for animated meshes, set once per frame, and the phase of the
+    // instance about to be drawn so neighbours do not move in lockstep
+    virtual void setAnimationTime(double millis) = 0;
+    virtual void setAnimationPhase(float phase) = 0;
+};
+
+Renderer* renderer = nullptr;
+
+GLuint createGLTexture(int width, int height, const GLubyte* rgba) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    checkGLError("createGLTexture");
+    return texture;
+}
+
+const char* primitiveName(Primitive primitive) {
+    static const char* names[] = { "Points", "Lines", "LineLoop", "Triangles", "TriangleStrip", "TriangleFan", "Quads" };
+    return names[(int)primitive];
+}
+
+const char* meshName(Mesh mesh) {
+    static const char* names[] = { "FishBody", "SharkBody", "Seaweed", "FishTail", "FishFins", "SharkBelly",
+                                   "SharkFins", "CrabLegs", "GrassBlade", "Sphere6", "Sphere8", "Sphere10", "Sphere12", "Sphere15" };
+    return names[(int)mesh];
+}
+
+GLenum primitiveMode(Primitive primitive) {
+    switch (primitive) {
+        case Primitive::Points: return GL_POINTS;
+        case Primitive::Lines: return GL_LINES;
+        case Primitive::LineLoop: return GL_LINE_LOOP;
+        case Primitive::Triangles: return GL_TRIANGLES;
+        case Primitive::TriangleStrip: return GL_TRIANGLE_STRIP;
+        case Primitive::TriangleFan: return GL_TRIANGLE_FAN;
+        case Primitive::Quads: return GL_QUADS;
+    }
+    return GL_POINTS;
+}
+
+// Fixed-function backend: the original immediate mode and display lists
+class LegacyRenderer : public Renderer {
+public:
+    const char* name() const override { return "fixed-function"; }
+
+    bool init() override {
+        glDepthFunc(GL_LEQUAL); // Use LEQUAL to handle depth precision
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+        glEnable(GL_LIGHT1);
+        glEnable(GL_NORMALIZE);
+        glShadeModel(GL_SMOOTH);
+        // Client arrays are read when the list is compiled, so each list
+        // holds its own copy of the mesh
+        meshLists.resize(meshes.size());
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            const MeshData& mesh = meshes[i];
+            meshLists[i] = glGenLists(1);
+            glNewList(meshLists[i], GL_COMPILE);
+            glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), mesh.vertices.data());
+            glNormalPointer(GL_FLOAT, 6 * sizeof(float), mesh.vertices.data() + 3);
+            glDrawElements(GL_TRIANGLES, (GLsizei)mesh.indices.size(), GL_UNSIGNED_SHORT, mesh.indices.data());
+            glEndList();
+        }
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        checkGLError("LegacyRenderer::init");
+        return true;
+    }
+
+    GLuint createTexture(int width, int height, const GLubyte* rgba) override {
+        return createGLTexture(width, height, rgba);
+    }
+
+    void setProjection(bool perspective, int width, int height) override {
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        if (perspective) {
+            gluPerspective(60.0, (float)width / height, 0.1, 10.0);
+            glTranslatef(0.0f, 0.0f, -2.0f);
+        } else {
+            glOrtho(-1.0, 1.0, -1.0, 1.0, -1.0, 10.0);
+        }
+        glMatrixMode(GL_MODELVIEW);
+    }
+
+    void clear(float r, float g, float b, float a) override {
+        glClearColor(r, g, b, a);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void pushMatrix() override { glPushMatrix(); }
+    void popMatrix() override { glPopMatrix(); }
+    void translate(float x, float y, float z) override { glTranslatef(x, y, z); }
+    void scale(float x, float y, float z) override { glScalef(x, y, z); }
+    void rotate(float degrees, float x, float y, float z) override { glRotatef(degrees, x, y, z); }
+
+    void setLight(int index, const float position[4], const float ambient[4],
+                  const float diffuse[4], const float specular[4]) override {
+        GLenum light = GL_LIGHT0 + index;
+        glLightfv(light, GL_POSITION, position);
+        glLightfv(light, GL_AMBIENT, ambient);
+        glLightfv(light, GL_DIFFUSE, diffuse);
+        glLightfv(light, GL_SPECULAR, specular);
+    }
+    void setLightPosition(int index, const float position[4]) override {
+        glLightfv(GL_LIGHT0 + index, GL_POSITION, position);
+    }
+    void setDiffuse(const float diffuse[4]) override { glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse); }
+    void setSpecular(const float specular[4]) override { glMaterialfv(GL_FRONT, GL_SPECULAR, specular); }
+    void setShininess(float shininess) override { glMaterialf(GL_FRONT, GL_SHININESS, shininess); }
+
+    void setLighting(bool enabled) override { enabled ? glEnable(GL_LIGHTING) : glDisable(GL_LIGHTING); }
+    void setBlending(bool enabled) override {
+        if (enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+    void setDepthTest(bool enabled) override { enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST); }
+    void setDepthWrite(bool enabled) override { glDepthMask(enabled ? GL_TRUE : GL_FALSE); }
+    void setTexture(GLuint texture) override {
+        if (texture != 0) {
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        } else {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glDisable(GL_TEXTURE_2D);
+        }
+    }
+    void setAlphaTest(bool enabled, float ref) override {
+        if (enabled) {
+            glEnable(GL_ALPHA_TEST);
+            glAlphaFunc(GL_GREATER, ref);
+        } else {
+            glDisable(GL_ALPHA_TEST);
+        }
+    }
+    void setPointSize(float size) override { glPointSize(size); }
+
+    void begin(Primitive primitive) override { glBegin(primitiveMode(primitive)); }
+    void color(float r, float g, float b, float a) override { glColor4f(r, g, b, a); }
+    void normal(float x, float y, float z) override { glNormal3f(x, y, z); }
+    void vertex(float x, float y, float z) override { glVertex3f(x, y, z); }
+    void end() override { glEnd(); }
+
+    void drawArrays(Primitive primitive, int count, const VertexArrays& arrays) override {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(arrays.positionSize, GL_FLOAT, 0, arrays.positions);
+        if (arrays.colors) {
+            glEnableClientState(GL_COLOR_ARRAY);
+            glColorPointer(4, GL_FLOAT, 0, arrays.colors);
+        }
+        if (arrays.texCoords) {
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glTexCoordPointer(2, GL_FLOAT, 0, arrays.texCoords);
+        }
+        glDrawArrays(primitiveMode(primitive), 0, count);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    // Fixed function has no vertex programs, so animated meshes are posed
+    // on the CPU each draw
+    void drawMesh(Mesh mesh) override {
+        const MeshData& data = meshes[(size_t)mesh];
+        if (!data.animated()) {
+            glCallList(meshLists[(size_t)mesh]);
+            return;
+        }
+        float drift = sinf(animationTime * data.driftRate + animationPhase);
+        float sway = sinf(animationTime * data.swayRate + animationPhase);
+        glPushMatrix();
+        glTranslatef(data.drift[0] * drift, data.drift[1] * drift, data.drift[2] * drift);
+        if (data.sway.empty()) {
+            glCallList(meshLists[(size_t)mesh]);
+        } else {
+            const std::vector<float>& v = data.vertices;
+            const std::vector<float>& s = data.sway;
+            posed.resize(s.size());
+            for (size_t i = 0, k = 0; i < s.size(); i += 3, k += 6) {
+                posed[i] = v[k] + s[i] * sway;
+                posed[i + 1] = v[k + 1] + s[i + 1] * sway;
+                posed[i + 2] = v[k + 2] + s[i + 2] * sway;
+            }
+            glEnableClientState(GL_VERTEX_ARRAY);
+            glEnableClientState(GL_NORMAL_ARRAY);
+            glVertexPointer(3, GL_FLOAT, 0, posed.data());
+            glNormalPointer(GL_FLOAT, 6 * sizeof(float), v.data() + 3);
+            glDrawElements(GL_TRIANGLES, (GLsizei)data.indices.size(), GL_UNSIGNED_SHORT, data.indices.data());
+            glDisableClientState(GL_NORMAL_ARRAY);
+            glDisableClientState(GL_VERTEX_ARRAY);
+        }
+        glPopMatrix();
+    }
+
+    void setAnimationTime(double millis) override { animationTime = (float)millis; }
+    void setAnimationPhase(float phase) override { animationPhase = phase; }
+
+private:
+    std::vector<GLuint> meshLists;
+    std::vector<float> posed;
+    float animationTime = 0.0f;
+    float animationPhase = 0.0f;
+};
+
+// Entry points above OpenGL 1.1 are loaded at runtime through GLUT so the
+// project keeps linking against plain opengl32/libGL without a loader library
+#define CORE_GL_FUNCTIONS(X) \
+    X(PFNGLCREATESHADERPROC, CreateShader) \
+    X(PFNGLSHADERSOURCEPROC, ShaderSource) \
+    X(PFNGLCOMPILESHADERPROC, CompileShader) \
+    X(PFNGLGETSHADERIVPROC, GetShaderiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, GetShaderInfoLog) \
+    X(PFNGLDELETESHADERPROC, DeleteShader) \
+    X(PFNGLCREATEPROGRAMPROC, CreateProgram) \
+    X(PFNGLATTACHSHADERPROC, AttachShader) \
+    X(PFNGLLINKPROGRAMPROC, LinkProgram) \
+    X(PFNGLGETPROGRAMIVPROC, GetProgramiv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, GetProgramInfoLog) \
+    X(PFNGLUSEPROGRAMPROC, UseProgram) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, GetUniformLocation) \
+    X(PFNGLUNIFORM1IPROC, Uniform1i) \
+    X(PFNGLUNIFORM1FPROC, Uniform1f) \
+    X(PFNGLUNIFORM2FPROC, Uniform2f) \
+    X(PFNGLUNIFORM3FVPROC, Uniform3fv) \
+    X(PFNGLUNIFORM4FVPROC, Uniform4fv) \
+    X(PFNGLUNIFORMMATRIX3FVPROC, UniformMatrix3fv) \
+    X(PFNGLUNIFORMMATRIX4FVPROC, UniformMatrix4fv) \
+    X(PFNGLGENVERTEXARRAYSPROC, GenVertexArrays) \
+    X(PFNGLBINDVERTEXARRAYPROC, BindVertexArray) \
+    X(PFNGLGENBUFFERSPROC, GenBuffers) \
+    X(PFNGLBINDBUFFERPROC, BindBuffer) \
+    X(PFNGLBUFFERDATAPROC, BufferData) \
+    X(PFNGLBUFFERSUBDATAPROC, BufferSubData) \
+    X(PFNGLDRAWELEMENTSBASEVERTEXPROC, DrawElementsBaseVertex) \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, VertexAttribPointer) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, EnableVertexAttribArray) \
+    X(PFNGLDISABLEVERTEXATTRIBARRAYPROC, DisableVertexAttribArray) \
+    X(PFNGLVERTEXATTRIB2FPROC, VertexAttrib2f) \
+    X(PFNGLVERTEXATTRIB4FPROC, VertexAttrib4f) \
+    X(PFNGLACTIVETEXTUREPROC, ActiveTexture)
+
+struct CoreGLFunctions {
+#define CORE_GL_DECLARE(type, name) type name = nullptr;
+    CORE_GL_FUNCTIONS(CORE_GL_DECLARE)
+#undef CORE_GL_DECLARE
+};
+CoreGLFunctions gl33;
+
+bool loadCoreGLFunctions() {
+    bool ok = true;
+#define CORE_GL_LOAD(type, name) \
+    gl33.name = reinterpret_cast<type>(glutGetProcAddress("gl" #name)); \
+    if (!gl33.name) { \
+        std::cerr << "Missing OpenGL entry point gl" #name << std::endl; \
+        ok = false; \
+    }
+    CORE_GL_FUNCTIONS(CORE_GL_LOAD)
+#undef CORE_GL_LOAD
+    return ok;
+}
+
+// Timer queries are core in 3.3 and exposed by ARB_timer_query on older
+// compatibility contexts; they are loaded separately so a missing extension
+// only disables GPU pass timing
+#define TIMER_GL_FUNCTIONS(X) \
+    X(PFNGLGENQUERIESPROC, GenQueries) \
+    X(PFNGLBEGINQUERYPROC, BeginQuery) \
+    X(PFNGLENDQUERYPROC, EndQuery) \
+    X(PFNGLGETQUERYOBJECTIVPROC, GetQueryObjectiv) \
+    X(PFNGLGETQUERYOBJECTUI64VPROC, GetQueryObjectui64v)
+
+struct TimerGLFunctions {
+#define TIMER_GL_DECLARE(type, name) type name = nullptr;
+    TIMER_GL_FUNCTIONS(TIMER_GL_DECLARE)
+#undef TIMER_GL_DECLARE
+};
+TimerGLFunctions glTimer;
+
+bool loadTimerGLFunctions() {
+    bool ok = true;
+#define TIMER_GL_LOAD(type, name) \
+    glTimer.name = reinterpret_cast<type>(glutGetProcAddress("gl" #name)); \
+    if (!glTimer.name) ok = false;
+    TIMER_GL_FUNCTIONS(TIMER_GL_LOAD)
+#undef TIMER_GL_LOAD
+    return ok;
+}
+
+bool glVersionAtLeast(int major, int minor) {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    int haveMajor = 0, haveMinor = 0;
+    if (!version || sscanf(version, "%d.%d", &haveMajor, &haveMinor) != 2) return false;
+    return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+}
+
+// Per-vertex lighting that mirrors the fixed-function equation for two
+// directional lights, the default material ambient and an infinite viewer
+const char* coreVertexShader = R"(#version 330 core
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec4 aColor;
+layout(location = 3) in vec2 aTexCoord;
+layout(location = 4) in vec3 aSway;
+
+uniform mat4 uModelView;
+uniform mat4 uProjection;
+uniform mat3 uNormalMatrix;
+uniform bool uLighting;
+uniform vec4 uLightPosition[2];
+uniform vec4 uLightAmbient[2];
+uniform vec4 uLightDiffuse[2];
+uniform vec4 uLightSpecular[2];
+uniform vec4 uMaterialDiffuse;
+uniform vec4 uMaterialSpecular;
+uniform float uShininess;
+uniform float uPointSize;
+uniform float uTime;
+uniform float uPhase;
+uniform vec2 uSwayRate;     // vertex sway, whole-mesh drift
+uniform vec3 uDrift;
+
+out vec4 vColor;
+out vec2 vTexCoord;
+
+void main() {
+    vec3 position = aPosition + aSway * sin(uTime * uSwayRate.x + uPhase)
+                  + uDrift * sin(uTime * uSwayRate.y + uPhase);
+    gl_Position = uProjection * uModelView * vec4(position, 1.0);
+    gl_PointSize = uPointSize;
+    vTexCoord = aTexCoord;
+    if (!uLighting) {
+        vColor = aColor;
+        return;
+    }
+    const vec3 materialAmbient = vec3(0.2);
+    const vec3 sceneAmbient = vec3(0.2);
+    vec3 n = normalize(uNormalMatrix * aNormal);
+    vec3 color = sceneAmbient * materialAmbient;
+    for (int i = 0; i < 2; ++i) {
+        vec3 l = normalize(uLightPosition[i].xyz);
+        float diffuse = max(dot(n, l), 0.0);
+        color += uLightAmbient[i].rgb * materialAmbient + diffuse * uLightDiffuse[i].rgb * uMaterialDiffuse.rgb;
+        if (diffuse > 0.0) {
+            vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));
+            float highlight = uShininess > 0.0 ? pow(max(dot(n, h), 0.0), uShininess) : 1.0;
+            color += highlight * uLightSpecular[i].rgb * uMaterialSpecular.rgb;
+        }
+    }
+    vColor = vec4(clamp(color, 0.0, 1.0), uMaterialDiffuse.a);
+}
+)";
+
+const char* coreFragmentShader = R"(#version 330 core
+in vec4 vColor;
+in vec2 vTexCoord;
+
+uniform bool uUseTexture;
+uniform sampler2D uTexture;
+uniform float uAlphaRef;
+
+out vec4 fragColor;
+
+void main() {
+    vec4 color = vColor;
+    if (uUseTexture) color *= texture(uTexture, vTexCoord);
+    if (color.a <= uAlphaRef) discard;
+    fragColor = color;
+}
+)";
+
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = gl33.CreateShader(type);
+    gl33.ShaderSource(shader, 1, &source, nullptr);
+    gl33.CompileShader(shader);
+    GLint ok = GL_FALSE;
+    gl33.GetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        gl33.GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "Shader compile failed: " << log << std::endl;
+        gl33.DeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint linkProgram(const char* vertexSource, const char* fragmentSource) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (!vs || !fs) return 0;
+    GLuint program = gl33.CreateProgram();
+    gl33.AttachShader(program, vs);
+    gl33.AttachShader(program, fs);
+    gl33.LinkProgram(program);
+    gl33.DeleteShader(vs);
+    gl33.DeleteShader(fs);
+    GLint ok = GL_FALSE;
+    gl33.GetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        gl33.GetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "Shader link failed: " << log << std::endl;
+        return 0;
+    }
+    return program;
+}
+
+// OpenGL 3.3 core backend. All static meshes share one vertex buffer, one
+// sway buffer and one index buffer behind a single VAO; the small
+// immediate-style shapes are staged on the CPU and appended to one stream
+// buffer that is orphaned once per frame. Uniforms are uploaded only when
+// the state behind them has changed since the last draw.
+class CoreRenderer : public Renderer {
+public:
+    const char* name() const override { return "core-3.3"; }
+
+    bool init() override {
+        if (!glVersionAtLeast(3, 3)) {
+            std::cerr << "OpenGL 3.3 is not available (have " << glGetString(GL_VERSION) << ")" << std::endl;
+            return false;
+        }
+        if (!loadCoreGLFunctions()) return false;
+        program = linkProgram(coreVertexShader, coreFragmentShader);
+        if (!program) return false;
+        gl33.UseProgram(program);
+        locModelView = gl33.GetUniformLocation(program, "uModelView");
+        locProjection = gl33.GetUniformLocation(program, "uProjection");
+        locNormalMatrix = gl33.GetUniformLocation(program, "uNormalMatrix");
+        locLighting = gl33.GetUniformLocation(program, "uLighting");
+        locLightPosition = gl33.GetUniformLocation(program, "uLightPosition");
+        locLightAmbient = gl33.GetUniformLocation(program, "uLightAmbient");
+        locLightDiffuse = gl33.GetUniformLocation(program, "uLightDiffuse");
+        locLightSpecular = gl33.GetUniformLocation(program, "uLightSpecular");
+        locMaterialDiffuse = gl33.GetUniformLocation(program, "uMaterialDiffuse");
+        locMaterialSpecular = gl33.GetUniformLocation(program, "uMaterialSpecular");
+        locShininess = gl33.GetUniformLocation(program, "uShininess");
+        locPointSize = gl33.GetUniformLocation(program, "uPointSize");
+        locUseTexture = gl33.GetUniformLocation(program, "uUseTexture");
+        locAlphaRef = gl33.GetUniformLocation(program, "uAlphaRef");
+        locTime = gl33.GetUniformLocation(program, "uTime");
+        locPhase = gl33.GetUniformLocation(program, "uPhase");
+        locSwayRate = gl33.GetUniformLocation(program, "uSwayRate");
+        locDrift = gl33.GetUniformLocation(program, "uDrift");
+        gl33.Uniform1i(gl33.GetUniformLocation(program, "uTexture"), 0);
+        gl33.ActiveTexture(GL_TEXTURE0);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+
+        gl33.GenVertexArrays(1, &streamVao);
+        gl33.GenBuffers(1, &streamVbo);
+        gl33.BindVertexArray(streamVao);
+        gl33.BindBuffer(GL_ARRAY_BUFFER, streamVbo);
+        gl33.BufferData(GL_ARRAY_BUFFER, streamCapacity, nullptr, GL_STREAM_DRAW);
+        setStreamVertexLayout();
+
+        // Meshes are appended one after another and drawn with a base
+        // vertex, so their 16-bit indices stay local. Rigid meshes get zero
+        // sway.
+        std::vector<float> vertices, sway;
+        std::vector<uint16_t> indices;
+        gpuMeshes.resize(meshes.size());
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            const MeshData& mesh = meshes[i];
+            GpuMesh& gpu = gpuMeshes[i];
+            gpu.baseVertex = (GLint)(vertices.size() / 6);
+            gpu.firstIndex = indices.size();
+            gpu.count = (GLsizei)mesh.indices.size();
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            if (mesh.sway.empty()) {
+                sway.resize(vertices.size() / 2, 0.0f);
+            } else {
+                sway.insert(sway.end(), mesh.sway.begin(), mesh.sway.end());
+            }
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        }
+        gl33.GenVertexArrays(1, &meshVao);
+        gl33.GenBuffers(1, &meshVbo);
+        gl33.GenBuffers(1, &swayVbo);
+        gl33.GenBuffers(1, &indexBuffer);
+        gl33.BindVertexArray(meshVao);
+        gl33.BindBuffer(GL_ARRAY_BUFFER, meshVbo);
+        gl33.BufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        gl33.VertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        gl33.VertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        gl33.EnableVertexAttribArray(0);
+        gl33.EnableVertexAttribArray(1);
+        gl33.BindBuffer(GL_ARRAY_BUFFER, swayVbo);
+        gl33.BufferData(GL_ARRAY_BUFFER, sway.size() * sizeof(float), sway.data(), GL_STATIC_DRAW);
+        gl33.VertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        gl33.EnableVertexAttribArray(4);
+        gl33.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        gl33.BufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+        gl33.BindVertexArray(0);
+        // Streamed shapes have no sway buffer, read this and stay put
+        gl33.VertexAttrib4f(4, 0.0f, 0.0f, 0.0f, 0.0f);
+
+        glDepthFunc(GL_LEQUAL);
+        modelView.assign(1, mat4Identity());
+        projection = mat4Identity();
+        checkGLError("CoreRenderer::init");
+        return true;
+    }
+
+    // Last frame's shapes may still be in flight, so the stream buffer is
+    // orphaned and refilled from the start
+    void beginFrame() override {
+        gl33.BindBuffer(GL_ARRAY_BUFFER, streamVbo);
+        gl33.BufferData(GL_ARRAY_BUFFER, streamCapacity, nullptr, GL_STREAM_DRAW);
+        streamOffset = 0;
+    }
+
+    GLuint createTexture(int width, int height, const GLubyte* rgba) override {
+        return createGLTexture(width, height, rgba);
+    }
+
+    void setProjection(bool perspective, int width, int height) override {
+        if (perspective) {
+            projection = mat4Multiply(mat4Perspective(60.0f, (float)width / height, 0.1f, 10.0f),
+                                      mat4Translate(0.0f, 0.0f, -2.0f));
+        } else {
+            projection = mat4Ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 10.0f);
+        }
+        dirty |= DirtyProjection;
+    }
+
+    void clear(float r, float g, float b, float a) override {
+        glClearColor(r, g, b, a);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void pushMatrix() override { modelView.push_back(modelView.back()); }
+    void popMatrix() override {
+        if (modelView.size() > 1) modelView.pop_back();
+        dirty |= DirtyModelView | DirtyNormalMatrix;
+    }
+    void translate(float x, float y, float z) override { multiply(mat4Translate(x, y, z)); }
+    void scale(float x, float y, float z) override { multiply(mat4Scale(x, y, z)); }
+    void rotate(float degrees, float x, float y, float z) override { multiply(mat4Rotate(degrees, x, y, z)); }
+
+    // Like glLightfv, positions are taken in eye space; the scene sets them
+    // with an identity modelview
+    void setLight(int index, const float position[4], const float ambient[4],
+                  const float diffuse[4], const float specular[4]) override {
+        std::copy(position, position + 4, lightPosition[index]);
+        std::copy(ambient, ambient + 4, lightAmbient[index]);
+        std::copy(diffuse, diffuse + 4, lightDiffuse[index]);
+        std::copy(specular, specular + 4, lightSpecular[index]);
+        dirty |= DirtyLights;
+    }
+    void setLightPosition(int index, const float position[4]) override {
+        std::copy(position, position + 4, lightPosition[index]);
+        dirty |= DirtyLights;
+    }
+    // Creatures set the same material again for every instance
+    void setDiffuse(const float diffuse[4]) override {
+        if (std::equal(diffuse, diffuse + 4, materialDiffuse)) return;
+        std::copy(diffuse, diffuse + 4, materialDiffuse);
+        dirty |= DirtyMaterial;
+    }
+    void setSpecular(const float specular[4]) override {
+        if (std::equal(specular, specular + 4, materialSpecular)) return;
+        std::copy(specular, specular + 4, materialSpecular);
+        dirty |= DirtyMaterial;
+    }
+    void setShininess(float value) override {
+        if (value == shininess) return;
+        shininess = value;
+        dirty |= DirtyMaterial;
+    }
+
+    void setLighting(bool enabled) override {
+        if (enabled == lighting) return;
+        lighting = enabled;
+        dirty |= DirtyLighting;
+    }
+    void setBlending(bool enabled) override {
+        if (enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+    void setDepthTest(bool enabled) override { enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST); }
+    void setDepthWrite(bool enabled) override { glDepthMask(enabled ? GL_TRUE : GL_FALSE); }
+    void setTexture(GLuint texture) override {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if ((texture != 0) == useTexture) return;
+        useTexture = texture != 0;
+        dirty |= DirtyTexture;
+    }
+    void setAlphaTest(bool enabled, float ref) override {
+        float value = enabled ? ref : -1.0f;
+        if (value == alphaRef) return;
+        alphaRef = value;
+        dirty |= DirtyAlphaRef;
+    }
+    void setPointSize(float size) override {
+        if (size == pointSize) return;
+        pointSize = size;
+        dirty |= DirtyPointSize;
+    }
+
+    void begin(Primitive p) override {
+        primitive = p;
+        staging.clear();
+    }
+    void color(float r, float g, float b, float a) override {
+        current.r = r; current.g = g; current.b = b; current.a = a;
+    }
+    void normal(float x, float y, float z) override {
+        current.nx = x; current.ny = y; current.nz = z;
+    }
+    void vertex(float x, float y, float z) override {
+        current.x = x; current.y = y; current.z = z;
+        staging.push_back(current);
+    }
+    void end() override { flush(primitive); }
+
+    void drawArrays(Primitive p, int count, const VertexArrays& arrays) override {
+        staging.clear();
+        RenderVertex v = current;
+        for (int i = 0; i < count; ++i) {
+            const float* pos = arrays.positions + i * arrays.positionSize;
+            v.x = pos[0];
+            v.y = pos[1];
+            v.z = arrays.positionSize > 2 ? pos[2] : 0.0f;
+            if (arrays.colors) {
+                v.r = arrays.colors[i * 4]; v.g = arrays.colors[i * 4 + 1];
+                v.b = arrays.colors[i * 4 + 2]; v.a = arrays.colors[i * 4 + 3];
+            }
+            if (arrays.texCoords) {
+                v.u = arrays.texCoords[i * 2];
+                v.v = arrays.texCoords[i * 2 + 1];
+            }
+            staging.push_back(v);
+        }
+        flush(p);
+    }
+
+    void drawMesh(Mesh mesh) override {
+        const GpuMesh& gpu = gpuMeshes[(size_t)mesh];
+        applyState();
+        applyAnimation(&meshes[(size_t)mesh]);
+        gl33.BindVertexArray(meshVao);
+        // Attributes the mesh does not store come from the current values
+        gl33.VertexAttrib4f(2, current.r, current.g, current.b, current.a);
+        gl33.VertexAttrib2f(3, 0.0f, 0.0f);
+        gl33.DrawElementsBaseVertex(GL_TRIANGLES, gpu.count, GL_UNSIGNED_SHORT,
+                                    (void*)(gpu.firstIndex * sizeof(uint16_t)), gpu.baseVertex);
+    }
+
+    void setAnimationTime(double millis) override { gl33.Uniform1f(locTime, (float)millis); }
+    void setAnimationPhase(float phase) override { gl33.Uniform1f(locPhase, phase); }
+
+private:
+    struct RenderVertex {
+        float x, y, z;
+        float nx, ny, nz;
+        float r, g, b, a;
+        float u, v;
+    };
+
+    // Where one mesh sits in the shared buffers
+    struct GpuMesh {
+        GLint baseVertex = 0;
+        size_t firstIndex = 0;
+        GLsizei count = 0;
+    };
+
+    // Uniform groups that changed since they were last uploaded
+    enum : unsigned {
+        DirtyModelView = 1 << 0,
+        DirtyNormalMatrix = 1 << 1,
+        DirtyProjection = 1 << 2,
+        DirtyLighting = 1 << 3,
+        DirtyLights = 1 << 4,
+        DirtyMaterial = 1 << 5,
+        DirtyPointSize = 1 << 6,
+        DirtyTexture = 1 << 7,
+        DirtyAlphaRef = 1 << 8,
+        DirtyAll = (1 << 9) - 1,
+        // Only read by the shader while lighting is on
+        DirtyLit = DirtyNormalMatrix | DirtyLights | DirtyMaterial
+    };
+
+    void multiply(const Mat4& m) {
+        modelView.back() = mat4Multiply(modelView.back(), m);
+        dirty |= DirtyModelView | DirtyNormalMatrix;
+    }
+
+    void setStreamVertexLayout() {
+        GLsizei stride = sizeof(RenderVertex);
+        gl33.VertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(RenderVertex, x));
+        gl33.VertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(RenderVertex, nx));
+        gl33.VertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(RenderVertex, r));
+        gl33.VertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(RenderVertex, u));
+        for (GLuint i = 0; i < 4; ++i) {
+            gl33.EnableVertexAttribArray(i);
+        }
+    }
+
+    // Unlit draws leave the lighting uniforms pending until a lit one
+    void applyState() {
+        unsigned pending = lighting ? dirty : dirty & ~DirtyLit;
+        if (!pending) return;
+        if (pending & DirtyModelView) gl33.UniformMatrix4fv(locModelView, 1, GL_FALSE, modelView.back().m);
+        if (pending & DirtyNormalMatrix) {
+            float normalMatrix[9];
+            mat4NormalMatrix(modelView.back(), normalMatrix);
+            gl33.UniformMatrix3fv(locNormalMatrix, 1, GL_FALSE, normalMatrix);
+        }
+        if (pending & DirtyProjection) gl33.UniformMatrix4fv(locProjection, 1, GL_FALSE, projection.m);
+        if (pending & DirtyLighting) gl33.Uniform1i(locLighting, lighting ? 1 : 0);
+        if (pending & DirtyLights) {
+            gl33.Uniform4fv(locLightPosition, 2, &lightPosition[0][0]);
+            gl33.Uniform4fv(locLightAmbient, 2, &lightAmbient[0][0]);
+            gl33.Uniform4fv(locLightDiffuse, 2, &lightDiffuse[0][0]);
+            gl33.Uniform4fv(locLightSpecular, 2, &lightSpecular[0][0]);
+        }
+        if (pending & DirtyMaterial) {
+            gl33.Uniform4fv(locMaterialDiffuse, 1, materialDiffuse);
+            gl33.Uniform4fv(locMaterialSpecular, 1, materialSpecular);
+            gl33.Uniform1f(locShininess, shininess);
+        }
+        if (pending & DirtyPointSize) gl33.Uniform1f(locPointSize, pointSize);
+        if (pending & DirtyTexture) gl33.Uniform1i(locUseTexture, useTexture ? 1 : 0);
+        if (pending & DirtyAlphaRef) gl33.Uniform1f(locAlphaRef, alphaRef);
+        dirty &= ~pending;
+    }
+
+    // Rates and drift of an animated mesh; streamed shapes pass none and
+    // are drawn where they were submitted
+    void applyAnimation(const MeshData* mesh) {
+        bool moving = mesh && mesh->animated();
+        if (!moving && !animating) return;
+        animating = moving;
+        const float none[3] = {};
+        gl33.Uniform2f(locSwayRate, moving ? mesh->swayRate : 0.0f, moving ? mesh->driftRate : 0.0f);
+        gl33.Uniform3fv(locDrift, 1, moving ? mesh->drift : none);
+    }
+
+    // Core profile has no quads, so they are split into triangle pairs here
+    void flush(Primitive p) {
+        if (staging.empty()) return;
+        const std::vector<RenderVertex>* upload = &staging;
+        GLenum mode = primitiveMode(p);
+        if (p == Primitive::Quads) {
+            expanded.clear();
+            for (size_t i = 0; i + 3 < staging.size(); i += 4) {
+                const int order[6] = { 0, 1, 2, 0, 2, 3 };
+                for (int k : order) expanded.push_back(staging[i + k]);
+            }
+            upload = &expanded;
+            mode = GL_TRIANGLES;
+        }
+        applyState();
+        applyAnimation(nullptr);
+        gl33.BindVertexArray(streamVao);
+        gl33.BindBuffer(GL_ARRAY_BUFFER, streamVbo);
+        size_t bytes = upload->size() * sizeof(RenderVertex);
+        if (streamOffset + bytes > streamCapacity) {
+            // Out of room mid-frame: start a larger buffer so later frames fit
+            streamCapacity = std::max(streamCapacity * 2, bytes);
+            gl33.BufferData(GL_ARRAY_BUFFER, streamCapacity, nullptr, GL_STREAM_DRAW);
+            streamOffset = 0;
+        }
+        gl33.BufferSubData(GL_ARRAY_BUFFER, streamOffset, bytes, upload->data());
+        glDrawArrays(mode, (GLint)(streamOffset / sizeof(RenderVertex)), (GLsizei)upload->size());
+        streamOffset += bytes;
+    }
+
+    GLuint program = 0, streamVao = 0, streamVbo = 0;
+    GLuint meshVao = 0, meshVbo = 0, swayVbo = 0, indexBuffer = 0;
+    GLint locModelView = -1, locProjection = -1, locNormalMatrix = -1, locLighting = -1;
+    GLint locLightPosition = -1, locLightAmbient = -1, locLightDiffuse = -1, locLightSpecular = -1;
+    GLint locMaterialDiffuse = -1, locMaterialSpecular = -1, locShininess = -1;
+    GLint locPointSize = -1, locUseTexture = -1, locAlphaRef = -1;
+    GLint locTime = -1, locPhase = -1, locSwayRate = -1, locDrift = -1;
+    std::vector<GpuMesh> gpuMeshes;
+    bool animating = false;
+    unsigned dirty = DirtyAll;
+    size_t streamCapacity = 256 * 1024, streamOffset = 0;
+
+    std::vector<Mat4> modelView;
+    Mat4 projection;
+    float lightPosition[2][4] = {};
+    float lightAmbient[2][4] = {};
+    float lightDiffuse[2][4] = {};
+    float lightSpecular[2][4] = {};
+    // Fixed-function defaults for GL_FRONT materials
+    float materialDiffuse[4] = { 0.8f, 0.8f, 0.8f, 1.0f };
+    float materialSpecular[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    float shininess = 0.0f;
+    bool lighting = false;
+    bool useTexture = false;
+    float alphaRef = -1.0f;
+    float pointSize = 1.0f;
+
+    Primitive primitive = Primitive::Triangles;
+    RenderVertex current = { 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0 };
+    std::vector<RenderVertex> staging, expanded;
+};
+
+// Accepts everything and does nothing, so benchmarks measure only the CPU
+// cost of walking the scene
+class NullRenderer : public Renderer {
+public:
+    const char* name() const override { return "null"; }
+    bool init() override { return true; }
+    GLuint createTexture(int, int, const GLubyte*) override { return 1; }
+    void setProjection(bool, int, int) override {}
+    void clear(float, float, float, float) override {}
+    void pushMatrix() override {}
+    void popMatrix() override {}
+    void translate(float, float, float) override {}
+    void scale(float, float, float) override {}
+    void rotate(float, float, float, float) override {}
+    void setLight(int, const float*, const float*, const float*, const float*) override {}
+    void setLightPosition(int, const float*) override {}
+    void setDiffuse(const float*) override {}
+    void setSpecular(const float*) override {}
+    void setShininess(float) override {}
+    void setLighting(bool) override {}
+    void setBlending(bool) override {}
+    void setDepthTest(bool) override {}
+    void setDepthWrite(bool) override {}
+    void setTexture(GLuint) override {}
+    void setAlphaTest(bool, float) override {}
+    void setPointSize(float) override {}
+    void begin(Primitive) override {}
+    void color(float, float, float, float) override {}
+    void normal(float, float, float) override {}
+    void vertex(float, float, float) override {}
+    void end() override {}
+    void drawArrays(Primitive, int, const VertexArrays&) override {}
+    void drawMesh(Mesh) override {}
+    void setAnimationTime(double) override {}
+    void setAnimationPhase(float) override {}
+};
+
+struct FrameStats {
+    long drawCalls = 0;
+    long vertices = 0;
+    long stateChanges = 0;       // lighting, blending, depth, texture, alpha test, point size, lights
+    long redundantStates = 0;    // state changes that set the value already in effect
+    long materialSwitches = 0;
+    long matrixOps = 0;
+};
+
+// Counts what a frame submits and forwards it to an optional inner backend.
+// With a command dump open it also writes every call as one line of text.
+class RecordingRenderer : public Renderer {
+public:
+    explicit RecordingRenderer(Renderer* inner) : inner(inner) {}
+
+    const char* name() const override { return "recording"; }
+    bool init() override { return inner ? inner->init() : true; }
+
+    void setDump(std::ostream* out, int frames) {
+        dump = out;
+        dumpFrames = frames;
+    }
+
+    void beginFrame() override {
+        frame = FrameStats();
+        if (dumping()) *dump << "frame " << frameCount << "\n";
+        if (inner) inner->beginFrame();
+    }
+
+    void endFrame() override {
+        if (inner) inner->endFrame();
+        if (dumping()) dump->flush();
+        total.drawCalls += frame.drawCalls;
+        total.vertices += frame.vertices;
+        total.stateChanges += frame.stateChanges;
+        total.redundantStates += frame.redundantStates;
+        total.materialSwitches += frame.materialSwitches;
+        total.matrixOps += frame.matrixOps;
+        last = frame;
+        ++frameCount;
+    }
+
+    GLuint createTexture(int width, int height, const GLubyte* rgba) override {
+        return inner ? inner->createTexture(width, height, rgba) : 1;
+    }
+
+    void setProjection(bool perspective, int width, int height) override {
+        ++frame.stateChanges;
+        if (dumping()) *dump << "setProjection " << (perspective ? "perspective " : "ortho ") << width << "x" << height << "\n";
+        if (inner) inner->setProjection(perspective, width, height);
+    }
+    void clear(float r, float g, float b, float a) override {
+        if (dumping()) *dump << "clear " << r << " " << g << " " << b << " " << a << "\n";
+        if (inner) inner->clear(r, g, b, a);
+    }
+
+    void pushMatrix() override {
+        ++frame.matrixOps;
+        if (dumping()) *dump << "pushMatrix\n";
+        if (inner) inner->pushMatrix();
+    }
+    void popMatrix() override {
+        ++frame.matrixOps;
+        if (dumping()) *dump << "popMatrix\n";
+        if (inner) inner->popMatrix();
+    }
+    void translate(float x, float y, float z) override {
+        ++frame.matrixOps;
+        if (dumping()) *dump << "translate " << x << " " << y << " " << z << "\n";
+        if (inner) inner->translate(x, y, z);
+    }
+    void scale(float x, float y, float z) override {
+        ++frame.matrixOps;
+        if (dumping()) *dump << "scale " << x << " " << y << " " << z << "\n";
+        if (inner) inner->scale(x, y, z);
+    }
+    void rotate(float degrees, float x, float y, float z) override {
+        ++frame.matrixOps;
+        if (dumping()) *dump << "rotate " << degrees << " " << x << " " << y << " " << z << "\n";
+        if (inner) inner->rotate(degrees, x, y, z);
+    }
+
+    void setLight(int index, const float position[4], const float ambient[4],
+                  const float diffuse[4], const float specular[4]) override {
+        ++frame.stateChanges;
+        if (dumping()) *dump << "setLight " << index << "\n";
+        if (inner) inner->setLight(index, position, ambient, diffuse, specular);
+    }
+    void setLightPosition(int index, const float position[4]) override {
+        ++frame.stateChanges;
+        if (dumping()) *dump << "setLightPosition " << index << " " << position[0] << " " << position[1] << " " << position[2] << "\n";
+        if (inner) inner->setLightPosition(index, position);
+    }
+    void setDiffuse(const float diffuse[4]) override {
+        ++frame.materialSwitches;
+        if (dumping()) *dump << "setDiffuse " << diffuse[0] << " " << diffuse[1] << " " << diffuse[2] << " " << diffuse[3] << "\n";
+        if (inner) inner->setDiffuse(diffuse);
+    }
+    void setSpecular(const float specular[4]) override {
+        ++frame.materialSwitches;
+        if (dumping()) *dump << "setSpecular " << specular[0] << " " << specular[1] << " " << specular[2] << "\n";
+        if (inner) inner->setSpecular(specular);
+    }
+    void setShininess(float shininess) override {
+        ++frame.materialSwitches;
+        if (dumping()) *dump << "setShininess " << shininess << "\n";
+        if (inner) inner->setShininess(shininess);
+    }
+
+    void setLighting(bool enabled) override {
+        countState(lighting, enabled);
+        if (dumping()) *dump << "setLighting " << enabled << "\n";
+        if (inner) inner->setLighting(enabled);
+    }
+    void setBlending(bool enabled) override {
+        countState(blending, enabled);
+        if (dumping()) *dump << "setBlending " << enabled << "\n";
+        if (inner) inner->setBlending(enabled);
+    }
+    void setDepthTest(bool enabled) override {
+        countState(depthTest, enabled);
+        if (dumping()) *dump << "setDepthTest " << enabled << "\n";
+        if (inner) inner->setDepthTest(enabled);
+    }
+    void setDepthWrite(bool enabled) override {
+        countState(depthWrite, enabled);
+        if (dumping()) *dump << "setDepthWrite " << enabled << "\n";
+        if (inner) inner->setDepthWrite(enabled);
+    }
+    void setTexture(GLuint texture) override {
+        countState(boundTexture, (int)texture);
+        if (dumping()) *dump << "setTexture " << texture << "\n";
+        if (inner) inner->setTexture(texture);
+    }
+    void setAlphaTest(bool enabled, float ref) override {
+        countState(alphaTest, enabled);
+        if (dumping()) *dump << "setAlphaTest " << enabled << " " << ref << "\n";
+        if (inner) inner->setAlphaTest(enabled, ref);
+    }
+    void setPointSize(float size) override {
+        countState(pointSize, size);
+        if (dumping()) *dump << "setPointSize " << size << "\n";
+        if (inner) inner->setPointSize(size);
+    }
+
+    void begin(Primitive primitive) override {
+        current = primitive;
+        batchVertices = 0;
+        if (inner) inner->begin(primitive);
+    }
+    void color(float r, float g, float b, float a) override {
+        if (inner) inner->color(r, g, b, a);
+    }
+    void normal(float x, float y, float z) override {
+        if (inner) inner->normal(x, y, z);
+    }
+    void vertex(float x, float y, float z) override {
+        ++batchVertices;
+        if (inner) inner->vertex(x, y, z);
+    }
+    void end() override {
+        ++frame.drawCalls;
+        frame.vertices += batchVertices;
+        if (dumping()) *dump << "draw " << primitiveName(current) << " " << batchVertices << "\n";
+        if (inner) inner->end();
+    }
+
+    void drawArrays(Primitive primitive, int count, const VertexArrays& arrays) override {
+        ++frame.drawCalls;
+        frame.vertices += count;
+        if (dumping()) *dump << "drawArrays " << primitiveName(primitive) << " " << count << "\n";
+        if (inner) inner->drawArrays(primitive, count, arrays);
+    }
+    void drawMesh(Mesh mesh) override {
+        long count = (long)meshes[(size_t)mesh].indices.size();
+        ++frame.drawCalls;
+        frame.vertices += count;
+        if (dumping()) *dump << "drawMesh " << meshName(mesh) << " " << count << "\n";
+        if (inner) inner->drawMesh(mesh);
+    }
+
+    void setAnimationTime(double millis) override {
+        if (dumping()) *dump << "setAnimationTime " << millis << "\n";
+        if (inner) inner->setAnimationTime(millis);
+    }
+    void setAnimationPhase(float phase) override {
+        if (dumping()) *dump << "setAnimationPhase " << phase << "\n";
+        if (inner) inner->setAnimationPhase(phase);
+    }
+
+    long frames() const { return frameCount; }
+    const FrameStats& lastFrame() const { return last; }
+
+    void printSummary(std::ostream& out) const {
+        double n = frameCount > 0 ? (double)frameCount : 1.0;
+        out << "Submission over " << frameCount << " frames (per frame): "
+            << total.drawCalls / n << " draw calls, "
+            << total.vertices / n << " vertices, "
+            << total.stateChanges / n << " state changes ("
+            << total.redundantStates / n << " redundant), "
+            << total.materialSwitches / n << " material switches, "
+            << total.matrixOps / n << " matrix ops" << std::endl;
+    }
+
+private:
+    template <typename T>
+    void countState(T& shadow, T value) {
+        ++frame.stateChanges;
+        if (shadow == value) ++frame.redundantStates;
+        shadow = value;
+    }
+
+    bool dumping() const { return dump && frameCount < dumpFrames; }
+
+    Renderer* inner;
+    std::ostream* dump = nullptr;
+    int dumpFrames = 0;
+    FrameStats frame, total, last;
+    long frameCount = 0;
+    Primitive current = Primitive::Triangles;
+    long batchVertices = 0;
+    bool lighting = false, blending = false, depthTest = false, alphaTest = false;
+    bool depthWrite = true;
+    int boundTexture = 0;
+    float pointSize = 1.0f;
+};
+
+RecordingRenderer* recorder = nullptr;
+std::ofstream commandDumpFile;
+
+// "auto" prefers the core backend and falls back to fixed function when the
+// driver is too old; "core" runs in a real 3.3 core-profile context
+Renderer* createBackend() {
+    if (config.renderer == "null" || config.renderer == "record") {
+        return new NullRenderer();
+    }
+    if (config.renderer != "legacy") {
+        CoreRenderer* core = new CoreRenderer();
+        if (core->init()) return core;
+        delete core;
+        if (config.renderer == "core") return nullptr;
+        std::cerr << "Falling back to the fixed-function renderer" << std::endl;
+    }
+    LegacyRenderer* legacy = new LegacyRenderer();
+    legacy->init();
+    return legacy;
+}
+
+// "record" records on top of the null backend; --record wraps any backend
+Renderer* createRenderer() {
+    Renderer* backend = createBackend();
+    if (!backend) return nullptr;
+    if (!config.recordStats && config.renderer != "record") return backend;
+    recorder = new RecordingRenderer(backend);
+    if (!config.commandDump.empty()) {
+        commandDumpFile.open(config.commandDump.c_str());
+        if (commandDumpFile) {
+            recorder->setDump(&commandDumpFile, config.dumpFrames);
+        } else {
+            std::cerr << "Cannot open " << config.commandDump << " for the command dump" << std::endl;
+        }
+    }
+    return recorder;
+}
+
+// Sort covers building and ordering the transparent list; the categories
+// after it are drawn interleaved in that order
+enum class RenderPass {
+    Background, Pebbles, Crabs, Rocks, Fish, Sharks, Food,
+    Sort, Grass, Seaweed, Bubbles, Ripples, Fins, Count
+};
+
+const char* passName(RenderPass pass) {
+    static const char* names[] = {
+        "background", "pebbles", "crabs", "rocks", "fish", "sharks", "food",
+        "sort", "grass", "seaweed", "bubbles", "ripples", "fins"
+    };
+    return names[(int)pass];
+}
+
+// CPU and GPU time per render pass. A pass may be begun and ended several
+// times in a frame and its time accumulates. GPU time comes from
+// GL_TIME_ELAPSED queries, one per interval, in two sets that alternate
+// between frames; each set is read back one frame after it was issued, so
+// the CPU never waits on the GPU. A pass with any result still not
+// available by then is dropped for that frame rather than waited for.
+class PassTimer {
+public:
+    static const int passCount = (int)RenderPass::Count;
+
+    void init(bool enabled, bool useGPU) {
+        this->enabled = enabled;
+        gpu = false;
+        if (!enabled || !useGPU) return;
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        bool supported = glVersionAtLeast(3, 3) ||
+            (extensions && strstr(extensions, "GL_ARB_timer_query"));
+        gpu = supported && loadTimerGLFunctions();
+        glGetError(); // GL_EXTENSIONS is invalid in a core context; the version check covers it
+    }
+
+    bool hasGPU() const { return gpu; }
+
+    void begin(RenderPass pass) {
+        if (!enabled) return;
+        cpuStart = std::chrono::steady_clock::now();
+        if (!gpu) return;
+        std::vector<Interval>& set = intervals[parity];
+        if (issued[parity] == set.size()) {
+            set.push_back({ 0, 0 });
+            glTimer.GenQueries(1, &set.back().query);
+        }
+        Interval& interval = set[issued[parity]];
+        interval.pass = (int)pass;
+        glTimer.BeginQuery(GL_TIME_ELAPSED, interval.query);
+    }
+
+    void end(RenderPass pass) {
+        if (!enabled) return;
+        if (gpu) {
+            glTimer.EndQuery(GL_TIME_ELAPSED);
+            ++issued[parity];
+        }
+        cpuMs[(int)pass] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+    }
+
+    void endFrame() {
+        if (!enabled) return;
+        ++frames;
+        parity ^= 1;
+        if (!gpu) return;
+        double frameMs[passCount] = {};
+        bool seen[passCount] = {}, missing[passCount] = {};
+        bool complete = true;
+        for (size_t n = 0; n < issued[parity]; ++n) {
+            const Interval& interval = intervals[parity][n];
+            int i = interval.pass;
+            seen[i] = true;
+            if (missing[i]) continue;
+            GLint available = 0;
+            glTimer.GetQueryObjectiv(interval.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                missing[i] = true;
+                complete = false;
+                ++dropped;
+                continue;
+            }
+            GLuint64 nanoseconds = 0;
+            glTimer.GetQueryObjectui64v(interval.query, GL_QUERY_RESULT, &nanoseconds);
+            frameMs[i] += nanoseconds * 1e-6;
+        }
+        issued[parity] = 0;
+        double total = 0.0;
+        for (int i = 0; i < passCount; ++i) {
+            total += frameMs[i];
+            if (!seen[i] || missing[i]) continue;
+            gpuMs[i] += frameMs[i];
+            ++gpuSamples[i];
+        }
+        if (complete) lastGPUFrameMs = total;
+    }
+
+    long frameCount() const { return frames; }
+
+    // GPU time of the newest frame whose every pass was read back, a frame
+    // or two behind; 0 without GPU timing
+    double gpuFrameMs() const { return lastGPUFrameMs; }
+
+    // Prints per-frame averages since the last report and starts a new window
+    void report(std::ostream& out) {
+        if (!enabled || frames == 0) return;
+        char line[96];
+        out << "Pass timings over " << frames << " frames (ms per frame"
+            << (gpu ? ", CPU / GPU" : ", CPU only") << "):" << std::endl;
+        for (int i = 0; i < passCount; ++i) {
+            if (gpu) {
+                double gpuAverage = gpuSamples[i] > 0 ? gpuMs[i] / gpuSamples[i] : 0.0;
+                snprintf(line, sizeof(line), "  %-10s %8.3f / %8.3f", passName((RenderPass)i), cpuMs[i] / frames, gpuAverage);
+            } else {
+                snprintf(line, sizeof(line), "  %-10s %8.3f", passName((RenderPass)i), cpuMs[i] / frames);
+            }
+            out << line << std::endl;
+            cpuMs[i] = gpuMs[i] = 0.0;
+            gpuSamples[i] = 0;
+        }
+        if (dropped > 0) {
+            out << "  " << dropped << " GPU results were not ready after a frame and were dropped" << std::endl;
+        }
+        frames = 0;
+        dropped = 0;
+    }
+
+private:
+    // One begin()/end() pair and the query that timed it on the GPU
+    struct Interval {
+        GLuint query;
+        int pass;
+    };
+
+    bool enabled = false;
+    bool gpu = false;
+    std::vector<Interval> intervals[2];     // grown on demand, reused every other frame
+    size_t issued[2] = {};
+    int parity = 0;
+    std::chrono::steady_clock::time_point cpuStart;
+    double cpuMs[passCount] = {};
+    double gpuMs[passCount] = {};
+    long gpuSamples[passCount] = {};
+    long frames = 0;
+    long dropped = 0;
+    double lastGPUFrameMs = 0.0;
+};
+PassTimer passTimer;
+
+void initGL() {
+    renderer->setProjection(false, windowWidth, windowHeight);
+    renderer->setLighting(true);
+    renderer->setDepthTest(true);
+
+    GLfloat lightPos[] = {0.0f, 0.0f, 1.0f, 0.0f};
+    GLfloat ambient[] = {0.3f, 0.3f, 0.4f, 1.0f};
+    GLfloat diffuse[] = {0.7f, 0.7f, 0.8f, 1.0f};
+    GLfloat specular[] = {0.5f, 0.5f, 0.6f, 1.0f};
+    renderer->setLight(0, lightPos, ambient, diffuse, specular);
+
+    GLfloat light1Pos[] = {0.0f, -0.5f, 0.5f, 0.0f};
+    GLfloat light1Ambient[] = {0.1f, 0.2f, 0.3f, 1.0f};
+    GLfloat light1Diffuse[] = {0.2f, 0.3f, 0.4f, 1.0f};
+    renderer->setLight(1, light1Pos, light1Ambient, light1Diffuse, specular);
+
+    checkGLError("initGL");
+}
+
+void reshape(int width, int height) {
+    windowWidth = width;
+    windowHeight = height > 0 ? height : 1;
+    glViewport(0, 0, windowWidth, windowHeight);
+    renderer->setProjection(usePerspective, windowWidth, windowHeight);
+    checkGLError("reshape");
+}
+
+// Discrete detail levels the quality governor moves between
+struct QualityTier {
+    const char* name;
+    int gradientBands;      // background gradient quads
+    float causticStep;      // caustic cell size on the sand; 0 turns caustics off
+    int sphereDrop;         // sphere meshes used this many steps coarser
+    float grassSpacing;     // distance between grass blades
+};
+
+const QualityTier qualityTiers[] = {
+    { "high", 50, 0.03f, 0, 0.02f },
+    { "medium", 32, 0.05f, 1, 0.03f },
+    { "low", 16, 0.1f, 2, 0.05f },
+    { "minimal", 8, 0.0f, 3, 0.08f },
+};
+const int qualityTierCount = sizeof(qualityTiers) / sizeof(qualityTiers[0]);
+
+// Steps down a tier when the rolling render time misses the target by 10%
+// and back up after a sustained run at or under it. Render time is the CPU
+// time spent submitting a frame plus the GPU time of its passes, not the
+// interval between frames, which the display timer sets on any machine fast
+// enough to keep up. An upgrade that has to be
+// undone soon after doubles the wait before the next attempt, so the tier
+// settles instead of flip-flopping around the target.
+struct QualityGovernor {
+    int tier = 0;
+    double averageMs = 0.0;     // exponential moving average of render time
+    int framesSinceChange = 0;
+    int upgradeHold = 120;      // frames at target needed before stepping up
+    bool lastChangeWasUpgrade = false;
+};
+QualityGovernor governor;
+
+const QualityTier& quality() {
+    return qualityTiers[governor.tier];
+}
+
+void setQualityTier(int tier, const char* reason) {
+    governor.tier = tier;
+    governor.framesSinceChange = 0;
+    std::cout << "Quality tier " << quality().name << " (" << reason << ", "
+              << governor.averageMs << " ms average render)" << std::endl;
+    if (haveGLContext) {
+        std::string title = std::string("Interactive Underwater World [") + quality().name + "]";
+        glutSetWindowTitle(title.c_str());
+    }
+}
+
+void updateQualityGovernor(double renderMs) {
+    if (config.targetFrameMs <= 0.0) return;
+    ++governor.framesSinceChange;
+    // Let the average settle after every change before judging the new tier
+    double alpha = governor.framesSinceChange < 30 ? 0.2 : 0.05;
+    governor.averageMs += (renderMs - governor.averageMs) * alpha;
+    if (governor.framesSinceChange < 30) return;
+
+    if (governor.averageMs > config.targetFrameMs * 1.1 && governor.tier < qualityTierCount - 1) {
+        if (governor.lastChangeWasUpgrade && governor.framesSinceChange < governor.upgradeHold) {
+            governor.upgradeHold = std::min(governor.upgradeHold * 2, 7680);
+        }
+        governor.lastChangeWasUpgrade = false;
+        setQualityTier(governor.tier + 1, "over target");
+    } else if (governor.averageMs <= config.targetFrameMs * 1.02 && governor.tier > 0 &&
+               governor.framesSinceChange >= governor.upgradeHold) {
+        governor.lastChangeWasUpgrade = true;
+        setQualityTier(governor.tier - 1, "under target");
+    }
+}
+
+// Sphere mesh to draw in place of `mesh` at the current quality tier
+Mesh sphereLod(Mesh mesh) {
+    return (Mesh)std::max((int)Mesh::Sphere6, (int)mesh - quality().sphereDrop);
+}
+
+// Spreads the animation phases of neighbouring slots around the circle
+float animationPhase(EntityHandle id) {
+    return id.index * 2.39996323f;
+}
+
+// Creatures are drawn in two parts: the opaque body in the opaque pass and
+// the translucent fins in the sorted transparent pass. Both parts push the
+// same model transform.
+void pushFishTransform(const CreatureInstance& f) {
+    renderer->pushMatrix();
+    renderer->translate(f.x, f.y, 0);
+    renderer->scale(f.facingRight ? 1 : -1, 1, 1);
+}
+
+void drawFishBody(const CreatureInstance& f) {
+    float scale = f.scale, r = f.r, g = f.g, b = f.b;
+    pushFishTransform(f);
+
+    GLfloat matDiffuse[] = {r, g, b, 1.0f};
+    GLfloat matSpecular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    GLfloat matShininess = 50.0f;
+    renderer->setDiffuse(matDiffuse);
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(matShininess);
+
+    renderer->pushMatrix();
+    renderer->scale(scale * 0.07f, scale * 0.035f, scale * 0.035f);
+    renderer->color(r + 0.1f, g + 0.1f, b + 0.1f, 1.0f);
+    renderer->drawMesh(Mesh::FishBody);
+    renderer->popMatrix();
+
+    GLfloat eyeDiffuse[] = {0.0f, 0.0f, 0.0f, 1.0f};
+    renderer->setDiffuse(eyeDiffuse);
+    renderer->pushMatrix();
+    renderer->translate(scale * 0.055f, scale * 0.01f, scale * 0.01f);
+    renderer->scale(scale * 0.007f, scale * 0.007f, scale * 0.007f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere10));
+    renderer->popMatrix();
+
+    renderer->popMatrix();
+    checkGLError("drawFishBody");
+}
+
+void drawFishFins(const CreatureInstance& f) {
+    float scale = f.scale, r = f.r, g = f.g, b = f.b;
+    pushFishTransform(f);
+    renderer->scale(scale, scale, scale);
+    renderer->setAnimationPhase(animationPhase(f.id));
+
+    GLfloat matSpecular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(50.0f);
+
+    GLfloat tailDiffuse[] = {std::max(0.0f, r - 0.25f), std::max(0.0f, g - 0.25f), std::max(0.0f, b - 0.25f), 0.7f};
+    renderer->setDiffuse(tailDiffuse);
+    renderer->drawMesh(Mesh::FishTail);
+
+    GLfloat finDiffuse[] = {std::max(0.0f, r - 0.15f), std::max(0.0f, g - 0.15f), std::max(0.0f, b - 0.15f), 0.7f};
+    renderer->setDiffuse(finDiffuse);
+    renderer->drawMesh(Mesh::FishFins);
+
+    renderer->popMatrix();
+    checkGLError("drawFishFins");
+}
+
+void pushSharkTransform(const CreatureInstance& s) {
+    renderer->pushMatrix();
+    renderer->translate(s.x, s.y, 0.0f);
+    renderer->scale(s.scale, s.scale, s.scale);
+    renderer->rotate(180.0f, 0.0f, 1.0f, 0.0f);
+    if (!s.facingRight) {
+        renderer->rotate(180.0f, 0.0f, 1.0f, 0.0f);
+    }
+}
+
+void drawSharkBody(const CreatureInstance& s) {
+    float r = s.r, g = s.g, b = s.b;
+    pushSharkTransform(s);
+    renderer->setAnimationPhase(animationPhase(s.id));
+
+    GLfloat matDiffuse[] = {r * 0.5f, g * 0.5f, b * 0.5f, 1.0f};
+    GLfloat matSpecular[] = {0.3f, 0.3f, 0.3f, 1.0f};
+    GLfloat matShininess = 20.0f;
+    renderer->setDiffuse(matDiffuse);
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(matShininess);
+
+    renderer->color(r * 0.5f + 0.15f, g * 0.5f + 0.15f, b * 0.5f + 0.15f, 1.0f);
+    renderer->drawMesh(Mesh::SharkBody);
+    GLfloat ventralDiffuse[] = {r * 0.8f, g * 0.8f, b * 0.8f, 1.0f};
+    renderer->setDiffuse(ventralDiffuse);
+    renderer->drawMesh(Mesh::SharkBelly);
+
+    renderer->pushMatrix();
+    renderer->translate(-0.3f, 0.08f, 0.08f);
+    GLfloat eyeDiffuse[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    renderer->setDiffuse(eyeDiffuse);
+    renderer->pushMatrix();
+    renderer->scale(0.03f, 0.03f, 0.03f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere10));
+    renderer->popMatrix();
+    renderer->translate(0.0f, 0.0f, 0.01f);
+    GLfloat pupilDiffuse[] = {0.0f, 0.0f, 0.0f, 1.0f};
+    renderer->setDiffuse(pupilDiffuse);
+    renderer->scale(0.01f, 0.02f, 0.01f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere8));
+    renderer->popMatrix();
+    renderer->pushMatrix();
+    renderer->translate(-0.3f, 0.08f, -0.08f);
+    renderer->setDiffuse(eyeDiffuse);
+    renderer->pushMatrix();
+    renderer->scale(0.03f, 0.03f, 0.03f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere10));
+    renderer->popMatrix();
+    renderer->translate(0.0f, 0.0f, -0.01f);
+    renderer->setDiffuse(pupilDiffuse);
+    renderer->scale(0.01f, 0.02f, 0.01f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere8));
+    renderer->popMatrix();
+
+    renderer->pushMatrix();
+    renderer->translate(-0.35f, 0.0f, 0.0f);
+    renderer->setLighting(false);
+    renderer->color(0.8f, 0.2f, 0.2f, 1.0f);
+    renderer->begin(Primitive::Quads);
+    renderer->vertex(0.0f, 0.05f, 0.05f);
+    renderer->vertex(0.05f, 0.05f, 0.05f);
+    renderer->vertex(0.05f, -0.05f, 0.05f);
+    renderer->vertex(0.0f, -0.05f, 0.05f);
+    renderer->vertex(0.0f, 0.05f, -0.05f);
+    renderer->vertex(0.05f, 0.05f, -0.05f);
+    renderer->vertex(0.05f, -0.05f, -0.05f);
+    renderer->vertex(0.0f, -0.05f, -0.05f);
+    renderer->end();
+    renderer->color(1.0f, 1.0f, 1.0f, 1.0f);
+    renderer->begin(Primitive::Triangles);
+    renderer->vertex(0.05f, 0.04f, 0.05f);
+    renderer->vertex(0.05f, 0.02f, 0.05f);
+    renderer->vertex(0.03f, 0.03f, 0.05f);
+    renderer->vertex(0.05f, -0.02f, 0.05f);
+    renderer->vertex(0.05f, -0.04f, 0.05f);
+    renderer->vertex(0.03f, -0.03f, 0.05f);
+    renderer->vertex(0.05f, 0.04f, -0.05f);
+    renderer->vertex(0.05f, 0.02f, -0.05f);
+    renderer->vertex(0.03f, 0.03f, -0.05f);
+    renderer->vertex(0.05f, -0.02f, -0.05f);
+    renderer->vertex(0.05f, -0.04f, -0.05f);
+    renderer->vertex(0.03f, -0.03f, -0.05f);
+    renderer->end();
+    renderer->setLighting(true);
+    renderer->popMatrix();
+
+    renderer->popMatrix();
+    checkGLError("drawSharkBody");
+}
+
+// Fins, tail and the translucent eye membranes
+void drawSharkFins(const CreatureInstance& s) {
+    float r = s.r, g = s.g, b = s.b;
+    pushSharkTransform(s);
+    renderer->setAnimationPhase(animationPhase(s.id));
+
+    GLfloat matSpecular[] = {0.3f, 0.3f, 0.3f, 1.0f};
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(20.0f);
+
+    GLfloat finDiffuse[] = {r, g, b, 0.6f};
+    renderer->setDiffuse(finDiffuse);
+    renderer->drawMesh(Mesh::SharkFins);
+
+    GLfloat membraneDiffuse[] = {1.0f, 1.0f, 1.0f, 0.3f};
+    renderer->setDiffuse(membraneDiffuse);
+    renderer->pushMatrix();
+    renderer->translate(-0.3f, 0.08f, 0.08f);
+    renderer->scale(0.02f, 0.02f, 0.01f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere8));
+    renderer->popMatrix();
+    renderer->pushMatrix();
+    renderer->translate(-0.3f, 0.08f, -0.08f);
+    renderer->scale(0.02f, 0.02f, 0.01f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere8));
+    renderer->popMatrix();
+
+    renderer->popMatrix();
+    checkGLError("drawSharkFins");
+}
+
+void initBubbleTexture() {
+    // Soft-edged disc used as the sprite for every bubble quad
+    const int size = 32;
+    GLubyte pixels[size * size * 4];
+    for (int j = 0; j < size; ++j) {
+        for (int i = 0; i < size; ++i) {
+            float dx = (i + 0.5f) / size * 2.0f - 1.0f;
+            float dy = (j + 0.5f) / size * 2.0f - 1.0f;
+            float d = sqrtf(dx * dx + dy * dy);
+            GLubyte* p = &pixels[(j * size + i) * 4];
+            p[0] = p[1] = p[2] = 255;
+            p[3] = d <= 1.0f ? 255 : 0;
+        }
+    }
+    bubbleTexture = renderer->createTexture(size, size, pixels);
+}
+
+void drawBubbles(const std::vector<BubbleInstance>& bubbleList) {
+    int count = (int)bubbleList.size();
+    if (count == 0) return;
+    if ((int)bubbleVertices.size() < count * 8) {
+        size_t first = bubbleTexCoords.size() / 8;
+        bubbleVertices.resize(count * 8);
+        bubbleTexCoords.resize(count * 8);
+        for (size_t i = first; i < (size_t)count; ++i) {
+            GLfloat* t = &bubbleTexCoords[i * 8];
+            t[0] = 0.0f; t[1] = 0.0f;
+            t[2] = 1.0f; t[3] = 0.0f;
+            t[4] = 1.0f; t[5] = 1.0f;
+            t[6] = 0.0f; t[7] = 1.0f;
+        }
+    }
+    GLfloat* v = bubbleVertices.data();
+    for (const auto& bubble : bubbleList) {
+        float x = bubble.x, y = bubble.y, r = bubble.radius;
+        v[0] = x - r; v[1] = y - r;
+        v[2] = x + r; v[3] = y - r;
+        v[4] = x + r; v[5] = y + r;
+        v[6] = x - r; v[7] = y + r;
+        v += 8;
+    }
+
+    renderer->setLighting(false);
+    renderer->setTexture(bubbleTexture);
+    renderer->setAlphaTest(true, 0.25f);
+    renderer->color(0.6f, 0.9f, 1.0f, 0.5f);
+    VertexArrays arrays = { 2, bubbleVertices.data(), nullptr, bubbleTexCoords.data() };
+    renderer->drawArrays(Primitive::Quads, count * 4, arrays);
+    renderer->setAlphaTest(false, 0.0f);
+    renderer->setTexture(0);
+    renderer->setLighting(true);
+    checkGLError("drawBubbles");
+}
+
+void drawRock(float x, float scale, float r, float g, float b) {
+    renderer->pushMatrix();
+    renderer->translate(x, -0.85f, 0.0f);
+    renderer->scale(scale, scale * 0.6f, scale);
+    GLfloat matDiffuse[] = {r, g, b, 1.0f};
+    GLfloat matSpecular[] = {0.2f, 0.2f, 0.2f, 1.0f};
+    renderer->setDiffuse(matDiffuse);
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(10.0f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere15));
+    renderer->popMatrix();
+    checkGLError("drawRock");
+}
+
+// Uniform in [0, 1]. Drawing keeps its own generators so it never disturbs
+// a world's sequence
+float unitRandom(std::minstd_rand& rng) {
+    return float(rng() - rng.min()) / float(rng.max() - rng.min());
+}
+
+void drawGrass() {
+    renderer->setLighting(false);
+    std::minstd_rand rng(54321);
+    for (float x = -1.0f; x < 1.0f; x += quality().grassSpacing) {
+        float height = 0.08f + unitRandom(rng) * 0.08f;
+        float green = 0.3f + unitRandom(rng) * 0.3f;
+        renderer->pushMatrix();
+        renderer->translate(x, -0.8f, 0.0f);
+        renderer->scale(1.0f, height, 1.0f);
+        renderer->setAnimationPhase(x * 5.0f);
+        renderer->color(0.0f, green, 0.0f, 0.8f);
+        renderer->drawMesh(Mesh::GrassBlade);
+        renderer->popMatrix();
+    }
+    renderer->setLighting(true);
+    checkGLError("drawGrass");
+}
+
+void drawPebbles() {
+    renderer->setLighting(true);
+    std::minstd_rand rng(12345);
+    for (int i = 0; i < 50; ++i) {
+        float x = unitRandom(rng) * 2.0f - 1.0f;
+        float y = -0.85f + unitRandom(rng) * 0.05f;
+        float scale = 0.01f + unitRandom(rng) * 0.02f;
+        float r = 0.4f + unitRandom(rng) * 0.3f;
+        float g = 0.3f + unitRandom(rng) * 0.3f;
+        float b = 0.2f + unitRandom(rng) * 0.3f;
+        renderer->pushMatrix();
+        renderer->translate(x, y, 0.0f);
+        renderer->scale(scale, scale, scale);
+        GLfloat matDiffuse[] = {r, g, b, 1.0f};
+        GLfloat matSpecular[] = {0.1f, 0.1f, 0.1f, 1.0f};
+        renderer->setDiffuse(matDiffuse);
+        renderer->setSpecular(matSpecular);
+        renderer->setShininess(5.0f);
+        renderer->drawMesh(sphereLod(Mesh::Sphere8));
+        renderer->popMatrix();
+    }
+    checkGLError("drawPebbles");
+}
+
+void drawSeaweed(const Seaweed& seaweed) {
+    renderer->setLighting(false);
+    renderer->pushMatrix();
+    renderer->translate(seaweed.x, -0.8f, 0.0f);
+    renderer->scale(1.0f, seaweed.height, 1.0f);
+    renderer->setAnimationPhase(seaweed.x * 3.0f);
+    renderer->color(0.0f, seaweed.green, 0.0f, 0.7f);
+    renderer->drawMesh(Mesh::Seaweed);
+    renderer->popMatrix();
+    renderer->setLighting(true);
+    checkGLError("drawSeaweed");
+}
+
+void drawRipples(const std::vector<Ripple>& rippleList) {
+    int count = (int)rippleList.size();
+    if (count == 0) return;
+    const int segments = 24;
+    const CircleTable& circle = circleTable(segments);
+    if ((int)rippleVertices.size() < count * segments * 4) {
+        rippleVertices.resize(count * segments * 4);
+        rippleColors.resize(count * segments * 8);
+    }
+    GLfloat* v = rippleVertices.data();
+    GLfloat* c = rippleColors.data();
+    for (const auto& ripple : rippleList) {
+        float alpha = ripple.life * 0.5f;
+        // GL_LINES needs both ends of every segment so all loops share one draw
+        for (int i = 0; i < segments; ++i) {
+            v[0] = ripple.x + ripple.radius * circle.cosTable[i];
+            v[1] = ripple.y + ripple.radius * circle.sinTable[i];
+            v[2] = ripple.x + ripple.radius * circle.cosTable[i + 1];
+            v[3] = ripple.y + ripple.radius * circle.sinTable[i + 1];
+            v += 4;
+            for (int k = 0; k < 2; ++k) {
+                c[0] = 0.7f; c[1] = 0.9f; c[2] = 1.0f; c[3] = alpha;
+                c += 4;
+            }
+        }
+    }
+
+    renderer->setLighting(false);
+    VertexArrays arrays = { 2, rippleVertices.data(), rippleColors.data(), nullptr };
+    renderer->drawArrays(Primitive::Lines, count * segments * 2, arrays);
+    renderer->setLighting(true);
+    checkGLError("drawRipples");
+}
+
+void drawCrab(const CreatureInstance& c) {
+    float scale = c.scale, r = c.r, g = c.g, b = c.b;
+    renderer->pushMatrix();
+    renderer->translate(c.x, c.y, 0.02f);
+    renderer->scale(c.facingRight ? scale : -scale, scale, scale);
+    renderer->setLighting(true);
+    renderer->setBlending(false);
+
+    GLfloat matDiffuse[] = {r, g, b, 1.0f};
+    GLfloat matSpecular[] = {0.4f, 0.4f, 0.4f, 1.0f};
+    renderer->setDiffuse(matDiffuse);
+    renderer->setSpecular(matSpecular);
+    renderer->setShininess(30.0f);
+    renderer->pushMatrix();
+    renderer->scale(0.1f, 0.04f, 0.05f);
+    renderer->drawMesh(sphereLod(Mesh::Sphere12));
+    renderer->popMatrix();
+
+    GLfloat legDiffuse[] = {r * 0.8f, g * 0.8f, b * 0.8f, 1.0f};
+    renderer->setDiffuse(legDiffuse);
+    renderer->setAnimationPhase(animationPhase(c.id));
+    renderer->drawMesh(Mesh::CrabLegs);
+
+    renderer->popMatrix();
+    checkGLError("drawCrab");
+}
+
+void drawBackground(const FrameTime& time) {
+    renderer->clear(0.0f, 0.4f, 0.7f, 1.0f);
+    checkGLError("clear");
+
+    renderer->setLighting(false);
+    renderer->setDepthTest(false);
+    renderer->setBlending(true);
+
+    float topY = 1.0f;
+    float bottomY = -0.8f;
+    int numSteps = quality().gradientBands;
+    float stepSize = (topY - bottomY) / numSteps;
+
+    float topColor[3] = {0.3f, 0.6f, 0.9f};
+    float bottomColor[3] = {0.1f, 0.3f, 0.5f};
+
+    renderer->pushMatrix();
+    renderer->translate(0.0f, 0.0f, -9.0f);
+    for (int i = 0; i < numSteps; ++i) {
+        float y0 = topY - i * stepSize;
+        float y1 = topY - (i + 1) * stepSize;
+        float t = (float)i / (numSteps - 1);
+
+        float r = topColor[0] + t * (bottomColor[0] - topColor[0]);
+        float g = topColor[1] + t * (bottomColor[1] - topColor[1]);
+        float b = topColor[2] + t * (bottomColor[2] - topColor[2]);
+
+        renderer->begin(Primitive::Quads);
+        renderer->color(r, g, b, 1.0f);
+        renderer->vertex(-1.0f, y0);
+        renderer->vertex(1.0f, y0);
+        renderer->color(r + (bottomColor[0] - topColor[0]) / numSteps,
+                  g + (bottomColor[1] - topColor[1]) / numSteps,
+                  b + (bottomColor[2] - topColor[2]) / numSteps, 1.0f);
+        renderer->vertex(1.0f, y1);
+        renderer->vertex(-1.0f, y1);
+        renderer->end();
+    }
+    renderer->popMatrix();
+
+    renderer->setDepthTest(true);
+    renderer->color(0.76f, 0.7f, 0.5f, 1.0f);
+    renderer->begin(Primitive::Quads);
+    renderer->vertex(-1.0f, -0.8f);
+    renderer->vertex(1.0f, -0.8f);
+    renderer->vertex(1.0f, -1.0f);
+    renderer->vertex(-1.0f, -1.0f);
+    renderer->end();
+
+    float step = quality().causticStep;
+    float t = (float)(time.millis * 0.001);
+    renderer->begin(Primitive::Quads);
+    for (float x = -1.0f; step > 0.0f && x < 1.0f; x += step) {
+        for (float y = -1.0f; y < -0.8f; y += step) {
+            float caustic1 = 0.5f + 0.5f * sinf(x * 10 + y * 10 + t);
+            float caustic2 = 0.5f + 0.5f * sinf(x * 15 - y * 12 + t * 0.7f);
+            float caustic = (caustic1 + caustic2) * 0.5f;
+            renderer->color(0.8f, 0.9f, 1.0f, caustic * 0.4f);
+            renderer->vertex(x, y);
+            renderer->vertex(x + step, y);
+            renderer->vertex(x + step, y + step);
+            renderer->vertex(x, y + step);
+        }
+    }
+    renderer->end();
+    renderer->setBlending(false);
+    renderer->setLighting(true);
+    checkGLError("drawBackground");
+}
+
+// Runs decide() on every entity whose decision is due, starting where the last
+// tick left off. decide() returns the number of ticks until its next decision.
+template <typename Pool, typename Decide>
+void runScheduledDecisions(AIScheduler& scheduler, Pool& entities, Decide decide) {
+    ++scheduler.tick;
+    scheduler.decisions = 0;
+    scheduler.deferred = 0;
+    size_t count = entities.size();
+    if (count == 0) return;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t first = scheduler.cursor % count;
+    bool overBudget = false;
+    for (size_t n = 0; n < count; ++n) {
+        size_t i = (first + n) % count;
+        auto& e = entities[i];
+        if (e.nextDecision > scheduler.tick) continue;
+        if (overBudget) {
+            ++scheduler.deferred;
+            continue;
+        }
+        e.nextDecision = scheduler.tick + std::max(1, decide(e, i));
+        ++scheduler.decisions;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() > scheduler.budgetMs) {
+            overBudget = true;
+            scheduler.cursor = i + 1;
+        }
+    }
+    if (!overBudget) {
+        scheduler.cursor = first;
+    }
+}
+
+// Staggers the first decision of a freshly spawned entity within one interval
+long staggeredDecisionTick(std::minstd_rand& rng, const AIScheduler& scheduler) {
+    return scheduler.tick + 1 + rng() % std::max(1, scheduler.interval);
+}
+
+long staggeredDecisionTick(World& world, const AIScheduler& scheduler) {
+    return staggeredDecisionTick(world.rng, scheduler);
+}
+
+int decideFlock(World& world, Schooling& s, size_t index) {
+    const auto& motion = column<Motion>(world.fishes);
+    const Motion& f = motion[index];
+    s.flockAngleSum = 0.0f;
+    s.flockCount = 0;
+    for (size_t j = 0; j < motion.size(); ++j) {
+        if (j == index) continue;
+        const Motion& other = motion[j];
+        float dx = f.x - other.x;
+        float dy = f.y - other.y;
+        float dist = sqrtf(dx * dx + dy * dy);
+        if (dist < 0.2f) {
+            s.flockAngleSum += other.angle;
+            s.flockCount++;
+        }
+    }
+    return world.fishScheduler.interval;
+}
+
+// Steering field. A grid of nodes 1/16 apart covers the tank; each node
+// remembers the nearest rock and the nearest food pellet that could matter
+// to something in the cells around it. Rocks are baked once by
+// initialize(); only the nodes around a pellet are patched when it is added
+// or removed. An entity then reads the four nodes around it, so steering
+// costs the same however much food and scenery the tank holds.
+
+const float flowMinX = -1.5f;
+const float flowMinY = -1.1f;
+const float flowCell = 1.0f / 16.0f;
+const int flowColumns = 49;
+const int flowRows = 37;
+const float rockY = -0.85f;          // rocks sit on the sand here
+const float rockRadius = 0.1f;       // and push away anything closer
+const float foodSight = 0.5f;        // fish steer to pellets this close
+const float foodBite = 0.05f;        // and eat them this close
+// A node is linked to whatever is in range of any point in its cells
+const float flowSlack = flowCell * 1.415f;
+
+// Calls visit(node, distSq) for each node within `reach` of (x, y)
+template <typename F>
+void forFlowNodesNear(float x, float y, float reach, F visit) {
+    int c0 = std::max(0, (int)ceilf((x - reach - flowMinX) / flowCell));
+    int c1 = std::min(flowColumns - 1, (int)floorf((x + reach - flowMinX) / flowCell));
+    int r0 = std::max(0, (int)ceilf((y - reach - flowMinY) / flowCell));
+    int r1 = std::min(flowRows - 1, (int)floorf((y + reach - flowMinY) / flowCell));
+    for (int r = r0; r <= r1; ++r) {
+        float dy = flowMinY + r * flowCell - y;
+        for (int c = c0; c <= c1; ++c) {
+            float dx = flowMinX + c * flowCell - x;
+            float distSq = dx * dx + dy * dy;
+            if (distSq < reach * reach) visit(r * flowColumns + c, distSq);
+        }
+    }
+}
+
+// Grid cell holding (x, y); points outside the grid go to the nearest edge
+// cell, which is never farther from a node than the point itself
+int flowCellOf(float x, float y) {
+    int c = std::max(0, std::min(flowColumns - 2, (int)floorf((x - flowMinX) / flowCell)));
+    int r = std::max(0, std::min(flowRows - 2, (int)floorf((y - flowMinY) / flowCell)));
+    return r * (flowColumns - 1) + c;
+}
+
+float flowNodeDistSq(int node, float x, float y) {
+    float dx = flowMinX + (node % flowColumns) * flowCell - x;
+    float dy = flowMinY + (node / flowColumns) * flowCell - y;
+    return dx * dx + dy * dy;
+}
+
+// The four nodes around (x, y) and their bilinear weights; positions
+// outside the grid use its edge
+struct FlowSample {
+    int node[4];
+    float weight[4];
+};
+
+FlowSample sampleFlow(float x, float y) {
+    float fx = std::max(0.0f, std::min(flowColumns - 1.001f, (x - flowMinX) / flowCell));
+    float fy = std::max(0.0f, std::min(flowRows - 1.001f, (y - flowMinY) / flowCell));
+    int c = (int)fx, r = (int)fy;
+    float u = fx - c, v = fy - r;
+    int node = r * flowColumns + c;
+    return { { node, node + 1, node + flowColumns, node + flowColumns + 1 },
+             { (1 - u) * (1 - v), u * (1 - v), (1 - u) * v, u * v } };
+}
+
+// Points the nodes around pellet k at it where it is the nearest
+void linkFoodNodes(World& world, int k) {
+    FlowField& flow = world.flow;
+    const Food& pellet = world.foodList[k];
+    forFlowNodesNear(pellet.x, pellet.y, foodSight + flowSlack, [&](int node, float distSq) {
+        if (flow.food[node] < 0 || distSq < flow.foodDistSq[node]) {
+            flow.food[node] = k;
+            flow.foodDistSq[node] = distSq;
+        }
+    });
+}
+
+void bakeFlowField(World& world) {
+    FlowField& flow = world.flow;
+    flow.rock.assign(flowColumns * flowRows, -1);
+    flow.food.assign(flowColumns * flowRows, -1);
+    flow.foodDistSq.assign(flowColumns * flowRows, 0.0f);
+    flow.cellFood.assign((flowColumns - 1) * (flowRows - 1), std::vector<int32_t>());
+    for (size_t k = 0; k < world.rocks.size(); ++k) {
+        const Rock& rock = world.rocks[k];
+        forFlowNodesNear(rock.x, rockY, rockRadius + flowSlack, [&](int node, float distSq) {
+            int current = flow.rock[node];
+            if (current < 0 || distSq < flowNodeDistSq(node, world.rocks[current].x, rockY)) {
+                flow.rock[node] = (int16_t)k;
+            }
+        });
+    }
+    for (size_t k = 0; k < world.foodList.size(); ++k) {
+        flow.cellFood[flowCellOf(world.foodList[k].x, world.foodList[k].y)].push_back((int32_t)k);
+        linkFoodNodes(world, (int)k);
+    }
+}
+
+void addFood(World& world, float x, float y) {
+    world.foodList.push_back({ x, y, 10.0f });
+    world.foodIds.push_back(world.nextFoodId++);
+    int k = (int)world.foodList.size() - 1;
+    world.flow.cellFood[flowCellOf(x, y)].push_back(k);
+    linkFoodNodes(world, k);
+}
+
+// Nearest pellet within `reach` of a node, searching the cells around it in
+// growing rings until a ring lies farther away than the best pellet so far;
+// -1 if there is none
+int nearestFoodFromNode(const World& world, int node, float reach, float& nearestSq) {
+    const FlowField& flow = world.flow;
+    int column = node % flowColumns, row = node / flowColumns;
+    int nearest = -1;
+    nearestSq = reach * reach;
+    int rings = (int)ceilf(reach / flowCell);
+    for (int ring = 0; ring <= rings; ++ring) {
+        // Every cell in ring n is at least n cells from the node
+        float gap = ring * flowCell;
+        if (gap * gap >= nearestSq) break;
+        int c0 = column - 1 - ring, c1 = column + ring;
+        int r0 = row - 1 - ring, r1 = row + ring;
+        for (int r = r0; r <= r1; ++r) {
+            if (r < 0 || r > flowRows - 2) continue;
+            bool edge = r == r0 || r == r1;
+            for (int c = c0; c <= c1; c += edge ? 1 : c1 - c0) {
+                if (c < 0 || c > flowColumns - 2) continue;
+                for (int j : flow.cellFood[r * (flowColumns - 1) + c]) {
+                    float distSq = flowNodeDistSq(node, world.foodList[j].x, world.foodList[j].y);
+                    if (distSq < nearestSq) {
+                        nearestSq = distSq;
+                        nearest = j;
+                    }
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+// Unlinks pellet k, hands its nodes to the next nearest pellet in range and
+// moves the last pellet into its slot. Only the nodes that pointed at k are
+// searched again, each through the cells around it: the more food there is,
+// the fewer such nodes and the sooner each search stops.
+void removeFood(World& world, int k) {
+    FlowField& flow = world.flow;
+    const Food removed = world.foodList[k];
+    const float reach = foodSight + flowSlack;
+    std::vector<int32_t>& cell = flow.cellFood[flowCellOf(removed.x, removed.y)];
+    cell.erase(std::find(cell.begin(), cell.end(), k));
+    std::vector<int>& orphans = flow.orphans;
+    orphans.clear();
+    forFlowNodesNear(removed.x, removed.y, reach, [&](int node, float) {
+        if (flow.food[node] == k) {
+            flow.food[node] = -1;
+            orphans.push_back(node);
+        }
+    });
+    int last = (int)world.foodList.size() - 1;
+    if (last > 0) {
+        for (int node : orphans) {
+            float nearestSq;
+            flow.food[node] = nearestFoodFromNode(world, node, reach, nearestSq);
+            flow.foodDistSq[node] = nearestSq;
+        }
+    }
+    if (k != last) {
+        world.foodList[k] = world.foodList[last];
+        world.foodIds[k] = world.foodIds[last];
+        std::vector<int32_t>& moved = flow.cellFood[flowCellOf(world.foodList[k].x, world.foodList[k].y)];
+        *std::find(moved.begin(), moved.end(), last) = k;
+        forFlowNodesNear(world.foodList[k].x, world.foodList[k].y, foodSight + flowSlack, [&](int node, float) {
+            if (flow.food[node] == last) flow.food[node] = k;
+        });
+    }
+    world.foodList.pop_back();
+    world.foodIds.pop_back();
+}
+
+// Removes pellets that were eaten or have dissolved
+void removeSpentFood(World& world) {
+    for (int k = (int)world.foodList.size() - 1; k >= 0; --k) {
+        if (world.foodList[k].life <= 0.0f) removeFood(world, k);
+    }
+}
+
+// Systems. Each one is instantiated per archetype, and tag dispatch on the
+// archetype's components selects the variant at compile time.
+
+// Default heading for schooling swimmers: drift toward the neighbours' average
+template <typename A>
+void schoolingSystem(World& world, A& a) {
+    auto& motion = column<Motion>(a);
+    auto& steering = column<Steering>(a);
+    const auto& schooling = column<Schooling>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        Motion& m = motion[i];
+        float avgAngle = (m.angle + schooling[i].flockAngleSum) / (1 + schooling[i].flockCount);
+        if (world.rng() % 100 < 2) {
+            m.angle += (unitRandom(world.rng) - 0.5f) * 0.5f;
+        }
+        m.speed = 0.002f + unitRandom(world.rng) * 0.005f;
+        steering[i] = { avgAngle, 0.2f };
+    }
+}
+
+// Eats food within reach and steers toward the nearest pellet in sight,
+// choosing among those linked from the four surrounding flow field nodes.
+// Unlike the rock push these are not blended: in scattered food the nodes
+// can name different pellets, and a fish aimed between them reaches neither.
+// Eaten pellets are marked spent and removed once every forager has moved.
+template <typename A>
+void foragingSystem(World& world, A& a) {
+    auto& motion = column<Motion>(a);
+    auto& steering = column<Steering>(a);
+    if (world.foodList.empty()) return;
+    bool ate = false;
+    for (size_t i = 0; i < motion.size(); ++i) {
+        Motion& m = motion[i];
+        FlowSample sample = sampleFlow(m.x, m.y);
+        float nearestSq = foodSight * foodSight;
+        float foodAngle = m.angle;
+        bool foodNearby = false;
+        for (int c = 0; c < 4; ++c) {
+            int k = world.flow.food[sample.node[c]];
+            if (k < 0 || world.foodList[k].life <= 0.0f) continue;
+            float dx = world.foodList[k].x - m.x;
+            float dy = world.foodList[k].y - m.y;
+            float distSq = dx * dx + dy * dy;
+            if (distSq < foodBite * foodBite) {
+                world.foodList[k].life = 0.0f;
+                ate = true;
+            } else if (distSq < nearestSq) {
+                nearestSq = distSq;
+                foodAngle = atan2f(dy, dx);
+                foodNearby = true;
+            }
+        }
+        if (foodNearby) {
+            m.speed = 0.008f;
+            steering[i] = { foodAngle, 0.6f };
+        }
+    }
+    if (ate) {
+        removeSpentFood(world);
+    }
+}
+
+// Rows of an archetype ordered by x. The order persists between ticks and
+// entities move little per tick, so an insertion sort restores it in close
+// to linear time; a size change rebuilds it from scratch.
+template <typename Column>
+void sortRowsByX(const Column& motion, std::vector<uint32_t>& order) {
+    auto less = [&motion](uint32_t a, uint32_t b) {
+        return motion[a].x < motion[b].x || (motion[a].x == motion[b].x && a < b);
+    };
+    if (order.size() != motion.size()) {
+        order.resize(motion.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = (uint32_t)i;
+        std::sort(order.begin(), order.end(), less);
+        return;
+    }
+    for (size_t i = 1; i < order.size(); ++i) {
+        uint32_t row = order[i];
+        size_t j = i;
+        for (; j > 0 && less(row, order[j - 1]); --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = row;
+    }
+}
+
+// Prey within eatRadius of its nearest predator is eaten and feeds only that
+// predator; within fleeRadius it flees from it. Predators are kept sorted by
+// x and each prey finds its place among them by binary search; the search
+// widens from there in both directions and stops on each side once the x gap
+// alone exceeds the nearest distance found so far. Ties go to the lower
+// predator row, so runs are reproducible.
+template <typename P, typename Q>
+void predationSystem(World& world, P& predators, Q& prey, std::vector<EntityHandle>& eaten) {
+    const float fleeRadius = world.config.fleeRadius;
+    const float eatRadius = world.config.eatRadius;
+    const auto& hunterMotion = column<Motion>(predators);
+    auto& hunters = column<Predator>(predators);
+    auto& motion = column<Motion>(prey);
+    auto& steering = column<Steering>(prey);
+    SweepAndPrune& sweep = world.predationBroadphase;
+    sortRowsByX(hunterMotion, sweep.hunters);
+    sweep.hunterX.resize(sweep.hunters.size());
+    for (size_t k = 0; k < sweep.hunters.size(); ++k) {
+        sweep.hunterX[k] = hunterMotion[sweep.hunters[k]].x;
+    }
+
+    const size_t count = sweep.hunters.size();
+    for (size_t i = 0; i < motion.size(); ++i) {
+        Motion& m = motion[i];
+        // First predator with x >= the prey's x
+        size_t cursor = std::lower_bound(sweep.hunterX.begin(), sweep.hunterX.end(), m.x) - sweep.hunterX.begin();
+
+        int nearest = -1;
+        float nearestSq = fleeRadius * fleeRadius;
+        auto test = [&](size_t k) {
+            uint32_t j = sweep.hunters[k];
+            float dx = m.x - sweep.hunterX[k];
+            float dy = m.y - hunterMotion[j].y;
+            float distSq = dx * dx + dy * dy;
+            ++sweep.candidates;
+            if (distSq < nearestSq || (distSq == nearestSq && (int)j < nearest)) {
+                nearest = (int)j;
+                nearestSq = distSq;
+            }
+        };
+        for (size_t k = cursor; k < count; ++k) {
+            float gap = sweep.hunterX[k] - m.x;
+            if (gap * gap > nearestSq) break;
+            test(k);
+        }
+        for (size_t k = cursor; k-- > 0;) {
+            float gap = m.x - sweep.hunterX[k];
+            if (gap * gap > nearestSq) break;
+            test(k);
+        }
+        if (nearest < 0) continue;
+
+        if (nearestSq < eatRadius * eatRadius) {
+            eaten.push_back(prey.handleAt(i));
+            hunters[nearest].hunger = std::min(1.0f, hunters[nearest].hunger + 0.2f);
+        } else {
+            m.speed = 0.01f;
+            steering[i] = { atan2f(m.y - hunterMotion[nearest].y, m.x - hunterMotion[nearest].x), 1.0f };
+        }
+    }
+}
+
+// Per-tick steering for whatever state decideShark() last chose
+template <typename P, typename Q>
+void huntSystem(World& world, P& predators, const Q& prey) {
+    auto& motion = column<Motion>(predators);
+    auto& steering = column<Steering>(predators);
+    auto& hunters = column<Predator>(predators);
+    const auto& preyMotion = column<Motion>(prey);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        Motion& m = motion[i];
+        Predator& p = hunters[i];
+        p.hunger -= world.config.sharkHungerRate;
+        if (p.hunger < 0.0f) p.hunger = 0.0f;
+        p.stateTimer -= 0.016f;
+
+        float targetAngle = m.angle;
+        float blend = 0.2f;
+        switch (p.state) {
+            case PredatorState::Chase: {
+                int row = prey.find(p.target);
+                if (row >= 0) {
+                    float dx = preyMotion[row].x - m.x;
+                    float dy = preyMotion[row].y - m.y;
+                    targetAngle = atan2f(dy, dx);
+                    if (sqrtf(dx * dx + dy * dy) < 0.5f) blend = 0.4f;
+                } else if (p.target.index != UINT32_MAX) {
+                    // Prey is gone; pick a new one on the next tick
+                    p.target = EntityHandle();
+                    p.nextDecision = world.sharkScheduler.tick + 1;
+                }
+                m.speed = 0.015f * (0.5f + p.hunger);
+                break;
+            }
+
+            case PredatorState::Patrol:
+                if (world.rng() % 100 < 10) {
+                    targetAngle += (unitRandom(world.rng) - 0.5f) * 0.5f;
+                }
+                m.speed = 0.006f;
+                break;
+
+            case PredatorState::Idle:
+                m.speed = 0.002f;
+                if (world.rng() % 100 < 5) {
+                    targetAngle += (unitRandom(world.rng) - 0.5f) * 0.3f;
+                }
+                break;
+
+            case PredatorState::Rest:
+                m.speed = 0.0f;
+                break;
+        }
+        steering[i] = { targetAngle, blend };
+    }
+}
+
+// Rocks sit on the sand at rockY and push away anything within rockRadius,
+// found through the flow field. Swimmers blend the push into their
+// steering; walkers turn back.
+template <typename A>
+void avoidRocksSystem(World& world, A& a) {
+    avoidRocksSystem(world, a, HasComponent<Walker, A>());
+}
+
+template <typename A>
+void avoidRocksSystem(World& world, A& a, std::false_type) {
+    const auto& motion = column<Motion>(a);
+    auto& steering = column<Steering>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        const Motion& m = motion[i];
+        if (m.speed == 0.0f) continue; // resting
+        FlowSample sample = sampleFlow(m.x, m.y);
+        float pushX = 0.0f, pushY = 0.0f, weight = 0.0f;
+        for (int c = 0; c < 4; ++c) {
+            int k = world.flow.rock[sample.node[c]];
+            if (k < 0) continue;
+            float dx = m.x - world.rocks[k].x;
+            float dy = m.y - rockY;
+            float dist = sqrtf(dx * dx + dy * dy);
+            if (dist >= rockRadius) continue;
+            pushX += sample.weight[c] * dx / dist;
+            pushY += sample.weight[c] * dy / dist;
+            weight += sample.weight[c];
+        }
+        if (weight > 0.0f) {
+            float repelAngle = atan2f(pushY, pushX);
+            steering[i].targetAngle = m.angle * 0.5f + repelAngle * 0.5f;
+        }
+    }
+}
+
+template <typename A>
+void avoidRocksSystem(World& world, A& a, std::true_type) {
+    const auto& motion = column<Motion>(a);
+    auto& walker = column<Walker>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        FlowSample sample = sampleFlow(motion[i].x, motion[i].y);
+        for (int c = 0; c < 4; ++c) {
+            int k = world.flow.rock[sample.node[c]];
+            if (k < 0) continue;
+            float dx = motion[i].x - world.rocks[k].x;
+            float dy = motion[i].y - rockY;
+            if (dx * dx + dy * dy < rockRadius * rockRadius) {
+                walker[i].blocked = true;
+                break;
+            }
+        }
+    }
+}
+
+template <typename A>
+void turnSystem(A& a) {
+    turnSystem(a, HasComponent<Walker, A>());
+}
+
+template <typename A>
+void turnSystem(A& a, std::false_type) {
+    auto& motion = column<Motion>(a);
+    const auto& steering = column<Steering>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        Motion& m = motion[i];
+        m.angle = m.angle * (1.0f - steering[i].blend) + steering[i].targetAngle * steering[i].blend;
+        m.facingRight = cosf(m.angle) > 0;
+    }
+}
+
+template <typename A>
+void turnSystem(A& a, std::true_type) {
+    auto& motion = column<Motion>(a);
+    auto& walker = column<Walker>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        if (!walker[i].blocked) continue;
+        Motion& m = motion[i];
+        m.speed = -m.speed;
+        m.facingRight = m.speed > 0;
+        m.y = std::max(a.bounds.minY, std::min(a.bounds.maxY, m.y));
+        walker[i].blocked = false;
+    }
+}
+
+// Swimmers follow their heading with a flattened vertical component;
+// walkers shuffle sideways and now and then change pace
+template <typename A>
+void moveSystem(World& world, A& a) {
+    moveSystem(world, a, HasComponent<Walker, A>());
+}
+
+template <typename A>
+void moveSystem(World&, A& a, std::false_type) {
+    for (auto& m : column<Motion>(a)) {
+        m.x += m.speed * cosf(m.angle);
+        m.y += m.speed * 0.1f * sinf(m.angle);
+    }
+}
+
+template <typename A>
+void moveSystem(World& world, A& a, std::true_type) {
+    for (auto& m : column<Motion>(a)) {
+        m.x += m.speed;
+        m.y += (unitRandom(world.rng) - 0.5f) * 0.002f;
+        if (world.rng() % 100 < 5) {
+            m.speed += (unitRandom(world.rng) - 0.5f) * 0.001f;
+            m.speed = std::max(-0.004f, std::min(0.004f, m.speed));
+        }
+    }
+}
+
+// Swimmers leaving one side re-enter from the other facing inward and are
+// clamped vertically; walkers outside their strip are marked to turn back
+template <typename A>
+void boundsSystem(A& a) {
+    boundsSystem(a, HasComponent<Walker, A>());
+}
+
+template <typename A>
+void boundsSystem(A& a, std::false_type) {
+    const Bounds& b = a.bounds;
+    for (auto& m : column<Motion>(a)) {
+        if (m.x > b.limitX) {
+            m.x = -b.limitX;
+            m.facingRight = true;
+            m.angle = 0.0f;
+        } else if (m.x < -b.limitX) {
+            m.x = b.limitX;
+            m.facingRight = false;
+            m.angle = 3.1416f;
+        }
+        if (m.y > b.maxY) m.y = b.maxY;
+        if (m.y < b.minY) m.y = b.minY;
+    }
+}
+
+template <typename A>
+void boundsSystem(A& a, std::true_type) {
+    const Bounds& b = a.bounds;
+    const auto& motion = column<Motion>(a);
+    auto& walker = column<Walker>(a);
+    for (size_t i = 0; i < motion.size(); ++i) {
+        const Motion& m = motion[i];
+        if (m.x > b.limitX || m.x < -b.limitX || m.y > b.maxY || m.y < b.minY) {
+            walker[i].blocked = true;
+        }
+    }
+}
+
+void updateFish(World& world) {
+    runScheduledDecisions(world.fishScheduler, column<Schooling>(world.fishes),
+                          [&world](Schooling& s, size_t i) { return decideFlock(world, s, i); });
+
+    world.eatenFish.clear();
+    schoolingSystem(world, world.fishes);
+    foragingSystem(world, world.fishes);
+    predationSystem(world, world.sharks, world.fishes, world.eatenFish);
+    avoidRocksSystem(world, world.fishes);
+    turnSystem(world.fishes);
+    moveSystem(world, world.fishes);
+    boundsSystem(world.fishes);
+
+    long respawnTick = world.tick + std::max(1L, (long)(world.config.fishRespawnSeconds / 0.016f));
+    for (EntityHandle handle : world.eatenFish) {
+        world.fishes.despawn(handle);
+        world.fishRespawnTicks.push_back(respawnTick);
+    }
+    world.fishEaten += (long)world.eatenFish.size();
+}
+
+// Random placement and colouring for a new fish
+void rollFish(std::minstd_rand& rng, Motion& m, Appearance& look) {
+    bool right = rng() % 2 == 0;
+    m = {
+        unitRandom(rng) * 2.0f - 1.0f,
+        unitRandom(rng) * 1.3f - 0.6f,
+        0.002f + unitRandom(rng) * 0.005f,
+        right ? 0.0f : 3.1416f,
+        right
+    };
+    look = {
+        (0.05f + unitRandom(rng) * 0.07f) * 4.5f,
+        unitRandom(rng),
+        unitRandom(rng),
+        unitRandom(rng)
+    };
+}
+
+// Adds a fish with random placement and colouring. With a parent row it is
+// bred instead: placed next to the parent and taking after it.
+EntityHandle spawnFish(World& world, int parent) {
+    Motion m;
+    Appearance look;
+    rollFish(world.rng, m, look);
+    if (parent >= 0) {
+        const Motion& pm = column<Motion>(world.fishes)[parent];
+        const Appearance& pl = column<Appearance>(world.fishes)[parent];
+        m.x = pm.x + (unitRandom(world.rng) - 0.5f) * 0.1f;
+        m.y = std::max(-0.6f, std::min(0.7f, pm.y + (unitRandom(world.rng) - 0.5f) * 0.1f));
+        look.scale = pl.scale;
+        look.r = pl.r * 0.8f + look.r * 0.2f;
+        look.g = pl.g * 0.8f + look.g * 0.2f;
+        look.b = pl.b * 0.8f + look.b * 0.2f;
+    }
+    Schooling school;
+    school.nextDecision = staggeredDecisionTick(world, world.fishScheduler);
+    return world.fishes.spawn(m, look, Steering(), Swimmer(), school, Forager(), Prey());
+}
+
+// Eaten fish come back once their delay is up: bred next to a random
+// survivor, or swimming in from the edge if none are left
+void respawnFish(World& world) {
+    for (size_t i = 0; i < world.fishRespawnTicks.size();) {
+        if (world.fishRespawnTicks[i] > world.tick || world.fishes.full()) {
+            ++i;
+            continue;
+        }
+        world.fishRespawnTicks[i] = world.fishRespawnTicks.back();
+        world.fishRespawnTicks.pop_back();
+
+        if (world.fishes.size() > 0) {
+            spawnFish(world, (int)(world.rng() % world.fishes.size()));
+        } else {
+            Motion& m = column<Motion>(world.fishes)[world.fishes.find(spawnFish(world, -1))];
+            m.x = m.facingRight ? -1.2f : 1.2f;
+        }
+    }
+}
+
+// State transitions and prey selection; huntSystem() steers toward whatever
+// was decided here on every tick in between.
+int decideShark(World& world, Predator& p, size_t index) {
+    const Motion& m = column<Motion>(world.sharks)[index];
+    if (p.stateTimer <= 0.0f) {
+        if (p.hunger > 0.6f && world.rng() % 100 < 70) {
+            if (p.state != PredatorState::Chase) {
+                emitBubbleBurst(world, m.x, m.y, world.config.chaseBubbleBurst);
+            }
+            p.state = PredatorState::Chase;
+            p.stateTimer = 5.0f + unitRandom(world.rng) * 5.0f;
+        } else if (p.hunger < 0.3f && world.rng() % 100 < 50) {
+            p.state = PredatorState::Rest;
+            p.stateTimer = 3.0f + unitRandom(world.rng) * 3.0f;
+        } else if (world.rng() % 100 < 60) {
+            p.state = PredatorState::Patrol;
+            p.stateTimer = 5.0f + unitRandom(world.rng) * 5.0f;
+        } else {
+            p.state = PredatorState::Idle;
+            p.stateTimer = 2.0f + unitRandom(world.rng) * 3.0f;
+        }
+    }
+
+    p.target = EntityHandle();
+    if (p.state == PredatorState::Chase) {
+        const auto& prey = column<Motion>(world.fishes);
+        float minDist = 1e9;
+        for (size_t i = 0; i < prey.size(); ++i) {
+            float dx = prey[i].x - m.x;
+            float dy = prey[i].y - m.y;
+            float dist = dx * dx + dy * dy;
+            if (dist < minDist) {
+                minDist = dist;
+                p.target = world.fishes.handleAt(i);
+            }
+        }
+    }
+
+    // Hunters re-target often; patrolling, idle and resting sharks check in
+    // less frequently, but never later than their state timer expires.
+    int ticks = world.sharkScheduler.interval;
+    if (p.state == PredatorState::Patrol) {
+        ticks *= 2;
+    } else if (p.state != PredatorState::Chase) {
+        ticks *= 4;
+    }
+    int untilExpiry = (int)ceilf(std::max(0.0f, p.stateTimer) / 0.016f);
+    return std::min(ticks, std::max(1, untilExpiry));
+}
+
+void updateSharks(World& world) {
+    runScheduledDecisions(world.sharkScheduler, column<Predator>(world.sharks),
+                          [&world](Predator& p, size_t i) { return decideShark(world, p, i); });
+
+    huntSystem(world, world.sharks, world.fishes);
+    avoidRocksSystem(world, world.sharks);
+    turnSystem(world.sharks);
+    moveSystem(world, world.sharks);
+    boundsSystem(world.sharks);
+}
+
+void initBubblePool(World& world, int capacity) {
+    world.bubbles.x.assign(capacity, 0.0f);
+    world.bubbles.y.assign(capacity, 0.0f);
+    world.bubbles.radius.assign(capacity, 0.0f);
+    world.bubbles.rise.assign(capacity, 0.0f);
+    world.bubbles.id.assign(capacity, 0);
+    world.bubbles.count = 0;
+    world.bubbles.nextId = 0;
+    world.bubbles.capacity = capacity;
+}
+
+void spawnBubble(World& world, float x, float y) {
+    if (world.bubbles.count >= world.bubbles.capacity) return;
+    int i = world.bubbles.count++;
+    float radius = 0.01f + unitRandom(world.rng) * 0.02f;
+    world.bubbles.x[i] = x;
+    world.bubbles.y[i] = y;
+    world.bubbles.radius[i] = radius;
+    world.bubbles.rise[i] = 0.004f + radius * 0.1f;
+    world.bubbles.id[i] = world.bubbles.nextId++;
+}
+
+void emitBubbleBurst(World& world, float x, float y, int count) {
+    for (int i = 0; i < count; ++i) {
+        spawnBubble(world, x + (unitRandom(world.rng) - 0.5f) * 0.1f,
+                    y + (unitRandom(world.rng) - 0.5f) * 0.05f);
+    }
+}
+
+void updateBubbles(World& world) {
+    for (auto& e : world.bubbleEmitters) {
+        e.accumulator += e.rate * 0.016f;
+        while (e.accumulator >= 1.0f) {
+            e.accumulator -= 1.0f;
+            spawnBubble(world, e.x + (unitRandom(world.rng) * 2.0f - 1.0f) * e.spread, e.y);
+        }
+    }
+
+    float* x = world.bubbles.x.data();
+    float* y = world.bubbles.y.data();
+    const float* rise = world.bubbles.rise.data();
+    for (int i = 0; i < world.bubbles.count; ++i) {
+        y[i] += rise[i];
+        x[i] += sinf(y[i] * 10.0f) * 0.002f;
+    }
+
+    // Retire bubbles that left the tank by moving the last live one into the slot
+    for (int i = 0; i < world.bubbles.count;) {
+        if (y[i] > 1.1f) {
+            int last = --world.bubbles.count;
+            world.bubbles.x[i] = world.bubbles.x[last];
+            world.bubbles.y[i] = world.bubbles.y[last];
+            world.bubbles.radius[i] = world.bubbles.radius[last];
+            world.bubbles.rise[i] = world.bubbles.rise[last];
+            world.bubbles.id[i] = world.bubbles.id[last];
+        } else {
+            ++i;
+        }
+    }
+}
+
+void initRipples(World& world, int capacity) {
+    world.ripples.slots.assign(capacity, Ripple{ 0.0f, 0.0f, 0.0f, 0.0f });
+    world.ripples.head = 0;
+    world.ripples.count = 0;
+}
+
+void addRipple(World& world, float x, float y) {
+    int capacity = (int)world.ripples.slots.size();
+    if (capacity == 0) return;
+    if (world.ripples.count == capacity) {
+        // Recycle the oldest ripple rather than growing
+        world.ripples.head = (world.ripples.head + 1) % capacity;
+        --world.ripples.count;
+    }
+    world.ripples.slots[(world.ripples.head + world.ripples.count) % capacity] = { x, y, 0.01f, 1.0f };
+    ++world.ripples.count;
+}
+
+void updateRipples(World& world) {
+    int capacity = (int)world.ripples.slots.size();
+    for (int n = 0; n < world.ripples.count; ++n) {
+        Ripple& r = world.ripples.slots[(world.ripples.head + n) % capacity];
+        r.radius += 0.005f;
+        r.life -= 0.02f;
+    }
+    while (world.ripples.count > 0 && world.ripples.slots[world.ripples.head].life <= 0.0f) {
+        world.ripples.head = (world.ripples.head + 1) % capacity;
+        --world.ripples.count;
+    }
+}
+
+void updateCrabs(World& world) {
+    moveSystem(world, world.crabs);
+    boundsSystem(world.crabs);
+    avoidRocksSystem(world, world.crabs);
+    turnSystem(world.crabs);
+    if (!world.verbose) return;
+    for (const auto& m : column<Motion>(world.crabs)) {
+        std::cout << "Updated crab at x=" << m.x << ", y=" << m.y << ", speed=" << m.speed << std::endl;
+    }
+}
+
+template <typename A>
+void publishInstances(const A& a, std::vector<CreatureInstance>& out) {
+    const auto& motion = column<Motion>(a);
+    const auto& look = column<Appearance>(a);
+    out.clear();
+    for (size_t i = 0; i < motion.size(); ++i) {
+        const Motion& m = motion[i];
+        const Appearance& l = look[i];
+        out.push_back({ m.x, m.y, l.scale, l.r, l.g, l.b, m.facingRight, a.handleAt(i) });
+    }
+}
+
+// Hands the filled writing slot to the reader and takes another to fill
+void commitSnapshot() {
+    int previous = snapshots.latest.exchange(snapshots.writing | 4);
+    snapshots.writing = previous & 3;
+}
+
+void publishSnapshot() {
+    RenderSnapshot& snap = snapshots.slots[snapshots.writing];
+    snap.tick = tank.tick;
+    publishInstances(tank.fishes, snap.fish);
+    publishInstances(tank.sharks, snap.sharks);
+    publishInstances(tank.crabs, snap.crabs);
+    snap.bubbles.resize(tank.bubbles.count);
+    for (int i = 0; i < tank.bubbles.count; ++i) {
+        snap.bubbles[i] = { tank.bubbles.x[i], tank.bubbles.y[i], tank.bubbles.radius[i] };
+    }
+    snap.ripples.clear();
+    int capacity = (int)tank.ripples.slots.size();
+    for (int n = 0; n < tank.ripples.count; ++n) {
+        snap.ripples.push_back(tank.ripples.slots[(tank.ripples.head + n) % capacity]);
+    }
+    snap.food = tank.foodList;
+    snap.rocks = tank.rocks;
+    snap.seaweeds = tank.seaweeds;
+    snap.perspective = perspectiveView;
+    commitSnapshot();
+}
+
+// Returns the newest published snapshot, or the last one read if the
+// simulation has not produced anything new since
+const RenderSnapshot& acquireSnapshot() {
+    if (snapshots.latest.load() & 4) {
+        snapshots.reading = snapshots.latest.exchange(snapshots.reading) & 3;
+    }
+    return snapshots.slots[snapshots.reading];
+}
+
+// Network streaming. A --serve process runs the only simulation and sends
+// every tick to its --connect clients, which draw it with the normal scene
+// code. Entities travel as quantized records sorted by key, and each frame
+// is a delta against the last frame sent to that client: records that did
+// not change cost nothing, so a frame grows with what moved, not with how
+// much is in the tank. The client patches its copy in place, so its work
+// grows the same way.
+//
+// Both directions use messages of a little-endian u32 length, a type byte
+// and a payload. The server opens with the greeting below and sends frames;
+// the client sends input. Frames carry
+//   tick, ticks back to the base (0 for a keyframe), perspective byte,
+// and then for each NetClass
+//   removed count, removed keys; changed count, changed records.
+// Keys ascend and are sent as differences. A changed record is its key, a
+// mask of the fields that differ from the base and those fields, positions
+// and sizes as zigzag differences and colours as raw bytes. Counts and
+// differences are LEB128 varints.
+
+const char netGreeting[4] = { 'U', 'W', 'N', '1' };
+const int netHistory = 64;               // ticks of snapshots the server keeps for delta bases
+const int netEditLog = 8;                // frames of edits a client keeps to bring render slots up to date
+const size_t netOutboxLimit = 1 << 20;   // frames are skipped for a client this far behind
+
+enum class NetMessage : uint8_t { Frame = 1, Input = 3 };
+enum class NetClass : uint8_t { Fish, Sharks, Crabs, Bubbles, Ripples, Food, Rocks, Seaweeds, Count };
+
+// One entity as it goes over the wire. Positions and sizes are fixed point
+// with 13 fractional bits, colours 8 bits per channel.
+struct NetRecord {
+    uint32_t key;       // entity slot, id, ring slot or index; stable while the thing lives
+    int16_t x, y;
+    uint16_t size;      // scale, radius or height
+    uint8_t r, g, b;
+    uint8_t flags;      // 1: facing right
+};
+
+enum NetField : uint8_t { NetX = 1, NetY = 2, NetSize = 4, NetColor = 8, NetFlags = 16 };
+
+struct NetSnapshot {
+    long tick = -1;
+    bool perspective = false;
+    std::vector<NetRecord> classes[(size_t)NetClass::Count];
+};
+
+int16_t quantizePosition(float v) {
+    return (int16_t)std::max(-32768.0f, std::min(32767.0f, roundf(v * 8192.0f)));
+}
+
+uint16_t quantizeSize(float v) {
+    return (uint16_t)std::max(0.0f, std::min(65535.0f, roundf(v * 8192.0f)));
+}
+
+uint8_t quantizeUnit(float v) {
+    return (uint8_t)std::max(0.0f, std::min(255.0f, roundf(v * 255.0f)));
+}
+
+NetRecord netRecord(uint32_t key, float x, float y, float size, float r, float g, float b, uint8_t flags) {
+    return { key, quantizePosition(x), quantizePosition(y), quantizeSize(size),
+             quantizeUnit(r), quantizeUnit(g), quantizeUnit(b), flags };
+}
+
+void sortNetRecords(std::vector<NetRecord>& records) {
+    std::sort(records.begin(), records.end(), [](const NetRecord& p, const NetRecord& q) { return p.key < q.key; });
+}
+
+template <typename A>
+void captureCreatures(const A& a, std::vector<NetRecord>& out) {
+    const auto& motion = column<Motion>(a);
+    const auto& look = column<Appearance>(a);
+    out.clear();
+    for (size_t i = 0; i < motion.size(); ++i) {
+        const Motion& m = motion[i];
+        const Appearance& l = look[i];
+        out.push_back(netRecord(a.handleAt(i).index, m.x, m.y, l.scale, l.r, l.g, l.b, m.facingRight ? 1 : 0));
+    }
+    sortNetRecords(out);
+}
+
+void captureNetSnapshot(const World& world, bool perspective, NetSnapshot& snap) {
+    snap.tick = world.tick;
+    snap.perspective = perspective;
+    captureCreatures(world.fishes, snap.classes[(size_t)NetClass::Fish]);
+    captureCreatures(world.sharks, snap.classes[(size_t)NetClass::Sharks]);
+    captureCreatures(world.crabs, snap.classes[(size_t)NetClass::Crabs]);
+    auto& bubbles = snap.classes[(size_t)NetClass::Bubbles];
+    bubbles.clear();
+    for (int i = 0; i < world.bubbles.count; ++i) {
+        bubbles.push_back(netRecord(world.bubbles.id[i], world.bubbles.x[i], world.bubbles.y[i], world.bubbles.radius[i], 0, 0, 0, 0));
+    }
+    sortNetRecords(bubbles);
+    auto& ripples = snap.classes[(size_t)NetClass::Ripples];
+    ripples.clear();
+    int capacity = (int)world.ripples.slots.size();
+    for (int n = 0; n < world.ripples.count; ++n) {
+        int slot = (world.ripples.head + n) % capacity;
+        const Ripple& ripple = world.ripples.slots[slot];
+        ripples.push_back(netRecord(slot, ripple.x, ripple.y, ripple.radius, ripple.life, 0, 0, 0));
+    }
+    sortNetRecords(ripples);
+    auto& food = snap.classes[(size_t)NetClass::Food];
+    food.clear();
+    for (size_t i = 0; i < world.foodList.size(); ++i) {
+        food.push_back(netRecord(world.foodIds[i], world.foodList[i].x, world.foodList[i].y, 0, 0, 0, 0, 0));
+    }
+    sortNetRecords(food);
+    auto& rocks = snap.classes[(size_t)NetClass::Rocks];
+    rocks.clear();
+    for (size_t i = 0; i < world.rocks.size(); ++i) {
+        const Rock& rock = world.rocks[i];
+        rocks.push_back(netRecord((uint32_t)i, rock.x, 0, rock.scale, rock.r, rock.g, rock.b, 0));
+    }
+    auto& seaweeds = snap.classes[(size_t)NetClass::Seaweeds];
+    seaweeds.clear();
+    for (size_t i = 0; i < world.seaweeds.size(); ++i) {
+        const Seaweed& seaweed = world.seaweeds[i];
+        seaweeds.push_back(netRecord((uint32_t)i, seaweed.x, 0, seaweed.height, 0, seaweed.green, 0, 0));
+    }
+}
+
+// What display() draws for one received record of each class
+CreatureInstance expandCreature(const NetRecord& n) {
+    EntityHandle id;
+    id.index = n.key;
+    return { n.x / 8192.0f, n.y / 8192.0f, n.size / 8192.0f, n.r / 255.0f, n.g / 255.0f, n.b / 255.0f, (n.flags & 1) != 0, id };
+}
+
+BubbleInstance expandBubble(const NetRecord& n) {
+    return { n.x / 8192.0f, n.y / 8192.0f, n.size / 8192.0f };
+}
+
+Ripple expandRipple(const NetRecord& n) {
+    return { n.x / 8192.0f, n.y / 8192.0f, n.size / 8192.0f, n.r / 255.0f };
+}
+
+Food expandFood(const NetRecord& n) {
+    return { n.x / 8192.0f, n.y / 8192.0f, 10.0f };
+}
+
+Rock expandRock(const NetRecord& n) {
+    return { n.x / 8192.0f, n.size / 8192.0f, n.r / 255.0f, n.g / 255.0f, n.b / 255.0f };
+}
+
+Seaweed expandSeaweed(const NetRecord& n) {
+    return { n.x / 8192.0f, n.size / 8192.0f, n.g / 255.0f };
+}
+
+// Calls visit(class, list, expand) for every class of a render snapshot
+template <typename Visit>
+void forNetClasses(RenderSnapshot& snap, Visit visit) {
+    visit(NetClass::Fish, snap.fish, expandCreature);
+    visit(NetClass::Sharks, snap.sharks, expandCreature);
+    visit(NetClass::Crabs, snap.crabs, expandCreature);
+    visit(NetClass::Bubbles, snap.bubbles, expandBubble);
+    visit(NetClass::Ripples, snap.ripples, expandRipple);
+    visit(NetClass::Food, snap.food, expandFood);
+    visit(NetClass::Rocks, snap.rocks, expandRock);
+    visit(NetClass::Seaweeds, snap.seaweeds, expandSeaweed);
+}
+
+// FNV-1a over every record, printed by both ends so a client's copy of a
+// tick can be checked against what the server sent
+uint64_t netSnapshotHash(const NetSnapshot& snap) {
+    uint64_t hash = 1469598103934665603ull;
+    for (const auto& records : snap.classes) {
+        for (const auto& n : records) {
+            uint32_t words[3] = { n.key, (uint32_t)(uint16_t)n.x | (uint32_t)(uint16_t)n.y << 16,
+                                  (uint32_t)n.size | (uint32_t)n.r << 16 | (uint32_t)n.g << 24 };
+            const unsigned char* p = (const unsigned char*)words;
+            for (size_t i = 0; i < sizeof(words); ++i) {
+                hash = (hash ^ p[i]) * 1099511628211ull;
+            }
+            hash = (hash ^ n.b) * 1099511628211ull;
+            hash = (hash ^ n.flags) * 1099511628211ull;
+        }
+        hash = (hash ^ 0xFF) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+void putSigned(std::vector<uint8_t>& out, int64_t v) {
+    putVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+// Bounds-checked cursor over a received payload; a short or malformed
+// payload clears `ok` and reads zeros from then on
+struct NetReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    NetReader(const uint8_t* data, size_t size) : p(data), end(data + size) {}
+
+    uint8_t byte() {
+        if (p >= end) {
+            ok = false;
+            return 0;
+        }
+        return *p++;
+    }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    int64_t signedVarint() {
+        uint64_t v = varint();
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+    float f32() {
+        float v = 0.0f;
+        if (end - p < 4) {
+            ok = false;
+            p = end;
+            return v;
+        }
+        memcpy(&v, p, 4);
+        p += 4;
+        return v;
+    }
+};
+
+struct NetDeltaStats {
+    long records = 0;    // entities in the frame
+    long changed = 0;    // sent because they were new or moved
+    long removed = 0;
+};
+
+// Appends the changes that turn `base` into `now`; a null base sends every
+// record in full
+void encodeNetClass(const std::vector<NetRecord>* base, const std::vector<NetRecord>& now,
+                    std::vector<uint8_t>& out, NetDeltaStats& stats) {
+    static const std::vector<NetRecord> empty;
+    const std::vector<NetRecord>& from = base ? *base : empty;
+    const NetRecord zero = {};
+    std::vector<uint32_t> removed;
+    std::vector<std::pair<const NetRecord*, const NetRecord*>> changed;   // (now, base or zero)
+    size_t b = 0;
+    for (const auto& record : now) {
+        while (b < from.size() && from[b].key < record.key) removed.push_back(from[b++].key);
+        if (b < from.size() && from[b].key == record.key) {
+            const NetRecord& old = from[b++];
+            if (memcmp(&old, &record, sizeof(NetRecord)) != 0) changed.push_back({ &record, &old });
+        } else {
+            changed.push_back({ &record, &zero });
+        }
+    }
+    while (b < from.size()) removed.push_back(from[b++].key);
+
+    putVarint(out, removed.size());
+    uint32_t previous = 0;
+    for (uint32_t key : removed) {
+        putVarint(out, key - previous);
+        previous = key;
+    }
+    putVarint(out, changed.size());
+    previous = 0;
+    for (const auto& change : changed) {
+        const NetRecord& n = *change.first;
+        const NetRecord& o = *change.second;
+        uint8_t mask = (n.x != o.x ? NetX : 0) | (n.y != o.y ? NetY : 0) | (n.size != o.size ? NetSize : 0) |
+                       (n.r != o.r || n.g != o.g || n.b != o.b ? NetColor : 0) | (n.flags != o.flags ? NetFlags : 0);
+        putVarint(out, n.key - previous);
+        previous = n.key;
+        out.push_back(mask);
+        if (mask & NetX) putSigned(out, n.x - o.x);
+        if (mask & NetY) putSigned(out, n.y - o.y);
+        if (mask & NetSize) putSigned(out, n.size - o.size);
+        if (mask & NetColor) {
+            out.push_back(n.r);
+            out.push_back(n.g);
+            out.push_back(n.b);
+        }
+        if (mask & NetFlags) out.push_back(n.flags);
+    }
+    stats.records += (long)now.size();
+    stats.changed += (long)changed.size();
+    stats.removed += (long)removed.size();
+}
+
+void encodeNetFrame(const NetSnapshot* base, const NetSnapshot& now, std::vector<uint8_t>& out, NetDeltaStats& stats) {
+    out.clear();
+    putVarint(out, (uint64_t)now.tick);
+    putVarint(out, base ? (uint64_t)(now.tick - base->tick) : 0);
+    out.push_back(now.perspective ? 1 : 0);
+    for (size_t c = 0; c < (size_t)NetClass::Count; ++c) {
+        encodeNetClass(base ? &base->classes[c] : nullptr, now.classes[c], out, stats);
+    }
+}
+
+// The client's copy of the stream. Each class keeps its records in no
+// particular order next to a map from key to position, so a frame touches
+// only the records it names.
+struct NetMirror {
+    long tick = -1;
+    bool perspective = false;
+    std::vector<NetRecord> classes[(size_t)NetClass::Count];
+    std::unordered_map<uint32_t, uint32_t> positions[(size_t)NetClass::Count];
+};
+
+// One change to a class's records, replayed on render snapshots. A removal
+// moves the last record into `position`; otherwise the record is written
+// there, or appended when `position` is one past the end.
+struct NetEdit {
+    bool remove;
+    uint32_t position;
+    NetRecord record;
+};
+
+// Applies one class's removals and changes to the mirror in place and notes
+// each as an edit. A removal of a key the mirror does not hold is malformed.
+bool decodeNetClass(NetReader& in, std::vector<NetRecord>& records,
+                    std::unordered_map<uint32_t, uint32_t>& positions, std::vector<NetEdit>& edits) {
+    uint64_t removals = std::min<uint64_t>(in.varint(), in.end - in.p);
+    uint32_t key = 0;
+    for (uint64_t i = 0; i < removals && in.ok; ++i) {
+        key += (uint32_t)in.varint();
+        auto found = positions.find(key);
+        if (found == positions.end()) return in.ok = false;
+        uint32_t position = found->second;
+        positions.erase(found);
+        if (position + 1 != records.size()) {
+            records[position] = records.back();
+            positions[records[position].key] = position;
+        }
+        records.pop_back();
+        edits.push_back({ true, position, NetRecord() });
+    }
+    uint64_t changes = std::min<uint64_t>(in.varint(), in.end - in.p);
+    key = 0;
+    for (uint64_t i = 0; i < changes && in.ok; ++i) {
+        key += (uint32_t)in.varint();
+        auto found = positions.find(key);
+        uint32_t position = found != positions.end() ? found->second : (uint32_t)records.size();
+        NetRecord record = {};
+        if (found != positions.end()) record = records[position];
+        record.key = key;
+        uint8_t mask = in.byte();
+        if (mask & NetX) record.x = (int16_t)(record.x + in.signedVarint());
+        if (mask & NetY) record.y = (int16_t)(record.y + in.signedVarint());
+        if (mask & NetSize) record.size = (uint16_t)(record.size + in.signedVarint());
+        if (mask & NetColor) {
+            record.r = in.byte();
+            record.g = in.byte();
+            record.b = in.byte();
+        }
+        if (mask & NetFlags) record.flags = in.byte();
+        if (found == positions.end()) {
+            positions[key] = position;
+            records.push_back(record);
+        } else {
+            records[position] = record;
+        }
+        edits.push_back({ false, position, record });
+    }
+    return in.ok;
+}
+
+// Replays a frame's edits of one class on a render snapshot that matched
+// the mirror before that frame
+template <typename T>
+void applyNetEdits(const std::vector<NetEdit>& edits, std::vector<T>& out, T (*expand)(const NetRecord&)) {
+    for (const auto& edit : edits) {
+        if (edit.remove) {
+            out[edit.position] = out.back();
+            out.pop_back();
+        } else if (edit.position == out.size()) {
+            out.push_back(expand(edit.record));
+        } else {
+            out[edit.position] = expand(edit.record);
+        }
+    }
+}
+
+#ifdef _WIN32
+typedef SOCKET NetSocket;
+const NetSocket invalidSocket = INVALID_SOCKET;
+#else
+typedef int NetSocket;
+const NetSocket invalidSocket = -1;
+#endif
+
+bool netStartup() {
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return true;
+#endif
+}
+
+void closeSocket(NetSocket s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+bool socketWouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void setNonBlocking(NetSocket s) {
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(s, FIONBIO, &on);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+void setNoDelay(NetSocket s) {
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+}
+
+// "unix:PATH" is a Unix domain socket; anything else is "[host:]port" over
+// TCP, with the host defaulting to 127.0.0.1
+NetSocket openNetSocket(const std::string& address, bool listening) {
+    NetSocket s = invalidSocket;
+    if (address.compare(0, 5, "unix:") == 0) {
+#ifdef _WIN32
+        std::cerr << "Unix domain sockets are not supported here; use a TCP port" << std::endl;
+        return invalidSocket;
+#else
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+            std::cerr << "Bad socket path " << path << std::endl;
+            return invalidSocket;
+        }
+        strcpy(local.sun_path, path.c_str());
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == invalidSocket) return s;
+        if (listening) {
+            unlink(path.c_str());
+            if (bind(s, (sockaddr*)&local, sizeof(local)) != 0 || listen(s, 8) != 0) {
+                closeSocket(s);
+                return invalidSocket;
+            }
+        } else if (connect(s, (sockaddr*)&local, sizeof(local)) != 0) {
+            closeSocket(s);
+            return invalidSocket;
+        }
+        return s;
+#endif
+    }
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0 || !found) {
+        std::cerr << "Cannot resolve " << address << std::endl;
+        return invalidSocket;
+    }
+    s = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    bool ok = s != invalidSocket;
+    if (ok && listening) {
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+        ok = bind(s, found->ai_addr, (int)found->ai_addrlen) == 0 && listen(s, 8) == 0;
+    } else if (ok) {
+        ok = connect(s, found->ai_addr, (int)found->ai_addrlen) == 0;
+        if (ok) setNoDelay(s);
+    }
+    freeaddrinfo(found);
+    if (!ok && s != invalidSocket) {
+        closeSocket(s);
+        s = invalidSocket;
+    }
+    return s;
+}
+
+// Framed messages over one stream socket. flush() and receive() move what
+// the socket takes or has without blocking on a non-blocking socket, and
+// wait for it on a blocking one.
+struct NetConnection {
+    NetSocket socket = invalidSocket;
+    std::vector<uint8_t> inbox, outbox;
+    size_t inboxRead = 0;
+    std::atomic<bool> open{ false };    // a client's receive thread clears it while input is sent
+    long bytesSent = 0, bytesReceived = 0;
+
+    void queue(NetMessage type, const uint8_t* payload, size_t size) {
+        uint32_t length = (uint32_t)size + 1;
+        for (int i = 0; i < 4; ++i) outbox.push_back((uint8_t)(length >> (8 * i)));
+        outbox.push_back((uint8_t)type);
+        outbox.insert(outbox.end(), payload, payload + size);
+    }
+
+    bool flush() {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (open && sent < outbox.size()) {
+            int n = (int)send(socket, (const char*)outbox.data() + sent, (int)(outbox.size() - sent), flags);
+            if (n > 0) {
+                sent += n;
+            } else if (n < 0 && socketWouldBlock()) {
+                break;
+            } else {
+                open = false;
+            }
+        }
+        bytesSent += (long)sent;
+        outbox.erase(outbox.begin(), outbox.begin() + sent);
+        return open;
+    }
+
+    bool receive() {
+        if (inboxRead > 0) {
+            inbox.erase(inbox.begin(), inbox.begin() + inboxRead);
+            inboxRead = 0;
+        }
+        uint8_t buffer[16384];
+        while (open) {
+            int n = (int)recv(socket, (char*)buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                inbox.insert(inbox.end(), buffer, buffer + n);
+                bytesReceived += n;
+                if ((size_t)n < sizeof(buffer)) break;
+            } else if (n < 0 && socketWouldBlock()) {
+                break;
+            } else {
+                open = false;
+            }
+        }
+        return open;
+    }
+
+    // Takes the next complete message out of the inbox
+    bool next(NetMessage& type, const uint8_t*& payload, size_t& size) {
+        size_t available = inbox.size() - inboxRead;
+        if (available < 5) return false;
+        const uint8_t* p = inbox.data() + inboxRead;
+        uint32_t length = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        if (length == 0 || length > (64u << 20)) {
+            open = false;
+            return false;
+        }
+        if (available < 4 + (size_t)length) return false;
+        type = (NetMessage)p[4];
+        payload = p + 5;
+        size = length - 1;
+        inboxRead += 4 + length;
+        return true;
+    }
+
+    void close() {
+        if (socket != invalidSocket) closeSocket(socket);
+        socket = invalidSocket;
+        open = false;
+    }
+};
+
+// Receives frames from a --serve process and publishes them as render
+// snapshots, in place of the local simulation. Input from the window goes
+// back to the server, which applies it at its next tick.
+class NetClient {
+public:
+    bool connect(const std::string& address) {
+        if (!netStartup()) return false;
+        connection.socket = openNetSocket(address, false);
+        if (connection.socket == invalidSocket) {
+            std::cerr << "Cannot connect to " << address << std::endl;
+            return false;
+        }
+        connection.open = true;
+        while (connection.inbox.size() < sizeof(netGreeting)) {
+            if (!connection.receive()) break;
+        }
+        if (connection.inbox.size() < sizeof(netGreeting) ||
+            memcmp(connection.inbox.data(), netGreeting, sizeof(netGreeting)) != 0) {
+            std::cerr << address << " is not an underwater world server" << std::endl;
+            connection.close();
+            return false;
+        }
+        connection.inboxRead = sizeof(netGreeting);
+        connected = true;
+        std::cout << "Connected to " << address << std::endl;
+        return true;
+    }
+
+    bool isConnected() const { return connected; }
+
+    // Blocks until the next frame is decoded and published; false once the
+    // server has gone
+    bool receiveFrame() {
+        while (connected) {
+            NetMessage type;
+            const uint8_t* payload;
+            size_t size;
+            while (connection.next(type, payload, size)) {
+                if (type != NetMessage::Frame) continue;
+                if (decodeFrame(payload, size)) return true;
+                // The mirror no longer matches the server, so no later delta applies
+                connected = false;
+                std::cout << "Dropping the connection after a bad frame" << std::endl;
+                return false;
+            }
+            if (!connection.open || !connection.receive()) {
+                connected = false;
+                std::cout << "Server closed the connection" << std::endl;
+            }
+        }
+        return false;
+    }
+
+    void sendInput(const InputEvent& e) {
+        uint8_t payload[9];
+        payload[0] = (uint8_t)e.type;
+        memcpy(payload + 1, &e.x, 4);
+        memcpy(payload + 5, &e.y, 4);
+        connection.queue(NetMessage::Input, payload, sizeof(payload));
+        connection.flush();
+    }
+
+    void start() {
+        running = true;
+        thread = std::thread([this] {
+            while (running.load() && receiveFrame()) {}
+        });
+    }
+
+    void stop() {
+        running = false;
+        // Shutting the socket down wakes the receiving thread
+        if (connection.socket != invalidSocket) {
+#ifdef _WIN32
+            shutdown(connection.socket, SD_BOTH);
+#else
+            shutdown(connection.socket, SHUT_RDWR);
+#endif
+        }
+        if (thread.joinable()) thread.join();
+        connection.close();
+        connected = false;
+    }
+
+    // The hash is over records in key order, as the server keeps them
+    void printSummary(std::ostream& out) const {
+        NetSnapshot sorted;
+        for (size_t c = 0; c < (size_t)NetClass::Count; ++c) {
+            sorted.classes[c] = mirror.classes[c];
+            sortNetRecords(sorted.classes[c]);
+        }
+        out << "Client received " << frames << " frames (" << keyframes << " keyframes), "
+            << (frames > 0 ? (double)connection.bytesReceived / frames : 0.0) << " bytes per frame, "
+            << (frames > 0 ? (double)edits / frames : 0.0) << " records patched per frame; last tick "
+            << mirror.tick << " snapshot hash " << std::hex << netSnapshotHash(sorted) << std::dec << std::endl;
+    }
+
+private:
+    // Edits of one decoded frame, by class
+    struct EditFrame {
+        bool keyframe = false;
+        std::vector<NetEdit> classes[(size_t)NetClass::Count];
+    };
+
+    // Patches the mirror with the frame and publishes it. The stream is
+    // ordered and lossless, so a delta's base is always the tick the mirror
+    // holds.
+    bool decodeFrame(const uint8_t* payload, size_t size) {
+        NetReader in(payload, size);
+        uint64_t tickBits = in.varint();
+        uint64_t backBits = in.varint();
+        if (!in.ok || tickBits > (uint64_t)LONG_MAX || backBits >= (uint64_t)netHistory || backBits > tickBits) {
+            std::cerr << "Malformed frame header" << std::endl;
+            return false;
+        }
+        long tick = (long)tickBits;
+        long back = (long)backBits;
+        if (back > 0 && mirror.tick != tick - back) {
+            std::cerr << "Frame " << tick << " is based on tick " << tick - back << " but this client holds "
+                      << mirror.tick << std::endl;
+            return false;
+        }
+        EditFrame& frame = editLog[(sequence + 1) % netEditLog];
+        frame.keyframe = back == 0;
+        if (frame.keyframe) {
+            for (size_t c = 0; c < (size_t)NetClass::Count; ++c) {
+                mirror.classes[c].clear();
+                mirror.positions[c].clear();
+            }
+        }
+        mirror.perspective = in.byte() != 0;
+        for (size_t c = 0; c < (size_t)NetClass::Count && in.ok; ++c) {
+            frame.classes[c].clear();
+            decodeNetClass(in, mirror.classes[c], mirror.positions[c], frame.classes[c]);
+            edits += (long)frame.classes[c].size();
+        }
+        if (!in.ok) {
+            mirror.tick = -1;
+            std::cerr << "Malformed frame " << tick << std::endl;
+            return false;
+        }
+        mirror.tick = tick;
+        ++sequence;
+        ++frames;
+        if (frame.keyframe) ++keyframes;
+        publish();
+        return true;
+    }
+
+    // Brings the slot being written up to the mirror by replaying the edits
+    // of the frames it missed. A slot that missed a keyframe, or more frames
+    // than the log holds, is rebuilt in full.
+    void publish() {
+        int slot = snapshots.writing;
+        RenderSnapshot& out = snapshots.slots[slot];
+        long from = slotSequence[slot];
+        bool replay = from >= 0 && sequence - from <= netEditLog;
+        for (long n = from + 1; replay && n <= sequence; ++n) {
+            replay = !editLog[n % netEditLog].keyframe;
+        }
+        if (replay) {
+            for (long n = from + 1; n <= sequence; ++n) {
+                const EditFrame& frame = editLog[n % netEditLog];
+                forNetClasses(out, [&](NetClass c, auto& list, auto expand) {
+                    applyNetEdits(frame.classes[(size_t)c], list, expand);
+                });
+            }
+        } else {
+            forNetClasses(out, [&](NetClass c, auto& list, auto expand) {
+                list.clear();
+                for (const auto& record : mirror.classes[(size_t)c]) list.push_back(expand(record));
+            });
+        }
+        out.tick = mirror.tick;
+        out.perspective = mirror.perspective;
+        slotSequence[slot] = sequence;
+        commitSnapshot();
+    }
+
+    NetConnection connection;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> connected{ false };
+    NetMirror mirror;
+    EditFrame editLog[netEditLog];
+    long sequence = -1;                         // frames decoded, less one
+    long slotSequence[3] = { -1, -1, -1 };      // frame each snapshot slot shows
+    long frames = 0, keyframes = 0, edits = 0;
+};
+NetClient netClient;
+
+void stopNetClient() {
+    netClient.stop();
+}
+
+// Appends recorded ticks to a columnar trajectory file (see trajectory.h).
+// The simulation thread only serializes into a recycled buffer; a writer
+// thread does the file I/O and flushes about once a second. When the writer
+// falls behind by more than the queue limit, ticks are dropped and counted
+// rather than stalling the simulation.
+class TrajectoryRecorder {
+public:
+    bool open(const std::string& path, size_t maxQueuedBytes, int every) {
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        TrajectoryFileHeader header;
+        memcpy(header.magic, trajectoryMagic, sizeof(header.magic));
+        header.version = trajectoryVersion;
+        header.headerBytes = sizeof(header);
+        fwrite(&header, sizeof(header), 1, file);
+        this->maxQueuedBytes = maxQueuedBytes;
+        this->every = std::max(1, every);
+        stopping = false;
+        writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void record(const World& world) {
+        if (world.tick % every != 0) return;
+        const FishArchetype& fishes = world.fishes;
+        const SharkArchetype& sharks = world.sharks;
+        const auto& fish = column<Motion>(fishes);
+        const auto& shark = column<Motion>(sharks);
+        const auto& hunters = column<Predator>(sharks);
+        TrajectoryTickHeader header;
+        header.tick = world.tick;
+        header.fishCount = (uint32_t)fish.size();
+        header.sharkCount = (uint32_t)shark.size();
+        header.foodCount = (uint32_t)world.foodList.size();
+        header.payloadBytes = trajectoryPayloadBytes(header.fishCount, header.sharkCount);
+        size_t bytes = sizeof(header) + header.payloadBytes;
+
+        std::vector<char> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queuedBytes > 0 && queuedBytes + bytes > maxQueuedBytes) {
+                ++dropped;
+                return;
+            }
+            queuedBytes += bytes;
+            if (!spare.empty()) {
+                buffer.swap(spare.back());
+                spare.pop_back();
+            }
+        }
+
+        buffer.resize(bytes);
+        char* out = buffer.data();
+        memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        size_t n = fish.size();
+        out = writeColumn<uint32_t>(out, n, [&fishes](size_t i) { return fishes.handleAt(i).index; });
+        out = writeColumn<uint32_t>(out, n, [&fishes](size_t i) { return fishes.handleAt(i).generation; });
+        out = writeColumn<float>(out, n, [&fish](size_t i) { return fish[i].x; });
+        out = writeColumn<float>(out, n, [&fish](size_t i) { return fish[i].y; });
+        out = writeColumn<float>(out, n, [&fish](size_t i) { return fish[i].angle; });
+        out = writeColumn<float>(out, n, [&fish](size_t i) { return fish[i].speed; });
+        n = shark.size();
+        out = writeColumn<uint32_t>(out, n, [&sharks](size_t i) { return sharks.handleAt(i).index; });
+        out = writeColumn<uint32_t>(out, n, [&sharks](size_t i) { return sharks.handleAt(i).generation; });
+        out = writeColumn<float>(out, n, [&shark](size_t i) { return shark[i].x; });
+        out = writeColumn<float>(out, n, [&shark](size_t i) { return shark[i].y; });
+        out = writeColumn<float>(out, n, [&hunters](size_t i) { return hunters[i].hunger; });
+        out = writeColumn<uint8_t>(out, n, [&hunters](size_t i) { return (uint8_t)hunters[i].state; });
+        memset(out, 0, buffer.data() + bytes - out);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(buffer));
+        }
+        wake.notify_one();
+    }
+
+    void close() {
+        if (!file) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        fclose(file);
+        file = nullptr;
+        std::cout << "Trajectory: " << written << " ticks written, " << dropped << " dropped" << std::endl;
+    }
+
+private:
+    template <typename T, typename Field>
+    static char* writeColumn(char* out, size_t count, Field field) {
+        for (size_t i = 0; i < count; ++i) {
+            T value = field(i);
+            memcpy(out + i * sizeof(T), &value, sizeof(T));
+        }
+        return out + count * sizeof(T);
+    }
+
+    void writerLoop() {
+        auto lastFlush = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait_for(lock, std::chrono::seconds(1), [this] { return stopping || !queue.empty(); });
+            while (!queue.empty()) {
+                std::vector<char> buffer = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+                fwrite(buffer.data(), 1, buffer.size(), file);
+                lock.lock();
+                ++written;
+                queuedBytes -= buffer.size();
+                spare.push_back(std::move(buffer));
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (stopping || now - lastFlush >= std::chrono::seconds(1)) {
+                fflush(file);
+                lastFlush = now;
+            }
+            if (stopping) break;
+        }
+    }
+
+    FILE* file = nullptr;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::vector<char>> queue;
+    std::vector<std::vector<char>> spare;   // written buffers kept for reuse
+    size_t queuedBytes = 0;
+    size_t maxQueuedBytes = 0;
+    int every = 1;
+    bool stopping = false;
+    long written = 0;
+    long dropped = 0;
+};
+TrajectoryRecorder trajectory;
+
+// Registered with atexit after the simulation thread is stopped
+void closeTrajectory() {
+    trajectory.close();
+}
+
+void openTrajectory() {
+    if (config.trajectoryPath.empty()) return;
+    if (!trajectory.open(config.trajectoryPath, (size_t)config.trajectoryBufferMb << 20, config.trajectoryEvery)) {
+        std::cerr << "Cannot open " << config.trajectoryPath << " for the trajectory" << std::endl;
+    }
+}
+
+const char* journalEventNames[] = { "food", "reset", "projection" };
+
+void writeJournalEntry(long tick, const InputEvent& e) {
+    fprintf(inputJournal.recordFile, "%ld %s", tick, journalEventNames[(int)e.type]);
+    if (e.type == InputEvent::Type::AddFood) {
+        fprintf(inputJournal.recordFile, " %.9g %.9g", e.x, e.y);
+    }
+    fprintf(inputJournal.recordFile, "\n");
+    fflush(inputJournal.recordFile);
+}
+
+// Reads a journal written by --record-input. Its seed is used unless --seed
+// was given.
+bool loadInputJournal(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open input journal " << path << std::endl;
+        return false;
+    }
+    std::string word;
+    while (in >> word) {
+        if (word[0] == '#') {
+            std::getline(in, word);
+            continue;
+        }
+        if (word == "seed") {
+            unsigned seed = 0;
+            in >> seed;
+            if (config.seed == 0) config.seed = seed;
+            continue;
+        }
+        JournalEntry entry = { atol(word.c_str()), { InputEvent::Type::Reset, 0.0f, 0.0f } };
+        std::string name;
+        in >> name;
+        if (name == "food") {
+            entry.event.type = InputEvent::Type::AddFood;
+            in >> entry.event.x >> entry.event.y;
+        } else if (name == "projection") {
+            entry.event.type = InputEvent::Type::ToggleProjection;
+        } else if (name != "reset") {
+            std::cerr << "Unknown input journal event '" << name << "' at tick " << entry.tick << std::endl;
+            return false;
+        }
+        if (!in) {
+            std::cerr << "Malformed input journal entry at tick " << entry.tick << std::endl;
+            return false;
+        }
+        inputJournal.replay.push_back(entry);
+    }
+    std::stable_sort(inputJournal.replay.begin(), inputJournal.replay.end(),
+                     [](const JournalEntry& a, const JournalEntry& b) { return a.tick < b.tick; });
+    inputJournal.replaying = true;
+    std::cout << "Replaying " << inputJournal.replay.size() << " inputs from " << path
+              << "; live input is ignored" << std::endl;
+    return true;
+}
+
+// Seeds the window's world, hands it the configuration and opens the input
+// journal. Must run before initialize() so the starting world comes from the
+// seed too.
+void seedSimulation() {
+    if (!config.replayInputPath.empty()) {
+        loadInputJournal(config.replayInputPath);
+    }
+    unsigned seed = config.seed != 0 ? config.seed : (unsigned)time(nullptr);
+    if (!config.recordInputPath.empty()) {
+        // Recorded sessions are seeded runs so a replay can match them exactly
+        config.seed = seed;
+        inputJournal.recordFile = fopen(config.recordInputPath.c_str(), "w");
+        if (inputJournal.recordFile) {
+            fprintf(inputJournal.recordFile, "# Interactive Underwater World input journal\nseed %u\n", seed);
+            fflush(inputJournal.recordFile);
+        } else {
+            std::cerr << "Cannot open " << config.recordInputPath << " for the input journal" << std::endl;
+        }
+    }
+    tank.config = config;
+    tank.verbose = config.verbose;
+    tank.rng.seed(seed);
+    std::cout << "Simulation seed " << seed << std::endl;
+}
+
+// Registered with atexit after the simulation thread is stopped
+void closeInputJournal() {
+    if (inputJournal.recordFile) {
+        fclose(inputJournal.recordFile);
+        inputJournal.recordFile = nullptr;
+    }
+}
+
+// Generates the tank and reports how long it took; the window runs this on
+// worldThread and publishes each stage as it lands
+void generateWorld(void (*stage)()) {
+    auto start = std::chrono::steady_clock::now();
+    initialize(tank, stage);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    int threads = worldgenThreadCount(tank.config);
+    std::cout << "World generated in " << ms << " ms on " << threads << (threads == 1 ? " thread, " : " threads, ")
+              << "complete " << startup.sinceLaunch() << " ms after launch" << std::endl;
+}
+
+void startWorldGeneration() {
+    worldReady = false;
+    worldThread = std::thread([] {
+        generateWorld(publishSnapshot);
+        worldReady = true;
+    });
+}
+
+// Registered with atexit so an early exit still joins the generator
+void finishWorldGeneration() {
+    if (worldThread.joinable()) {
+        worldThread.join();
+    }
+}
+
+// XOR-folded FNV-1a over the simulated entities, for checking that two
+// replays of the same journal ended in the same state
+uint64_t simulationChecksum(const World& world) {
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](const void* data, size_t bytes) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+    };
+    for (const auto& m : column<Motion>(world.fishes)) mix(&m, offsetof(Motion, facingRight));
+    for (const auto& m : column<Motion>(world.sharks)) mix(&m, offsetof(Motion, facingRight));
+    for (const auto& m : column<Motion>(world.crabs)) mix(&m, offsetof(Motion, facingRight));
+    for (const auto& f : world.foodList) mix(&f, sizeof(f));
+    mix(world.bubbles.y.data(), world.bubbles.count * sizeof(float));
+    return hash;
+}
+
+void applyInput() {
+    std::vector<InputEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        events.swap(pendingInput);
+    }
+    if (inputJournal.replaying) {
+        events.clear();
+        while (inputJournal.next < inputJournal.replay.size() && inputJournal.replay[inputJournal.next].tick <= tank.tick) {
+            events.push_back(inputJournal.replay[inputJournal.next++].event);
+        }
+    }
+    for (const auto& e : events) {
+        if (inputJournal.recordFile) {
+            writeJournalEntry(tank.tick, e);
+        }
+        if (e.type == InputEvent::Type::ToggleProjection) {
+            perspectiveView = !perspectiveView;
+        } else if (e.type == InputEvent::Type::Reset) {
+            initialize(tank);
+        } else if (e.type == InputEvent::Type::AddFood) {
+            addFood(tank, e.x, e.y);
+            addRipple(tank, e.x, e.y);
+            std::cout << "Added food at wx=" << e.x << ", wy=" << e.y << std::endl;
+        }
+    }
+}
+
+void queueInput(const InputEvent& e) {
+    if (netClient.isConnected()) {
+        netClient.sendInput(e);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(inputMutex);
+    pendingInput.push_back(e);
+}
+
+// Advances one world by one tick
+void stepWorld(World& world) {
+    respawnFish(world);
+    updateFish(world);
+    updateSharks(world);
+    updateBubbles(world);
+    updateRipples(world);
+    updateCrabs(world);
+    for (auto& food : world.foodList) {
+        food.life -= 0.016f;
+    }
+    removeSpentFood(world);
+    ++world.tick;
+}
+
+void simulateTick() {
+    applyInput();
+    stepWorld(tank);
+    if (trajectory.isOpen()) {
+        trajectory.record(tank);
+    }
+    publishSnapshot();
+}
+
+// Ticks every 16 ms of scaled time; while paused it only waits
+void simulationLoop() {
+    auto next = std::chrono::steady_clock::now();
+    while (simRunning.load()) {
+        double period = 16.0;
+        if (!animationClock.paused && worldReady.load()) {
+            simulateTick();
+            period /= std::max(0.05f, animationClock.scale.load());
+        }
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(period));
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void startSimulationThread() {
+    simRunning = true;
+    simThread = std::thread(simulationLoop);
+}
+
+// Registered with atexit so the worker stops before globals are destroyed
+void stopSimulationThread() {
+    simRunning = false;
+    if (simThread.joinable()) {
+        simThread.join();
+    }
+}
+
+// One sortable draw. The sort is stable, so draws with equal keys keep the
+// order they were added in.
+enum class DrawKind : uint8_t { Body, Grass, Seaweed, Bubbles, Ripples, FishFins, SharkFins };
+
+struct DrawItem {
+    uint32_t key;
+    uint32_t index;         // row in the snapshot list `kind` draws from
+    DrawKind kind;
+};
+
+std::vector<DrawItem> opaqueItems, transparentItems, sortScratch;
+
+// How far a point is from the eye at z = 2 in the perspective view, squared;
+// larger is farther. The orthographic view looks straight down z and
+// everything in the tank sits on z = 0, so there it has no depth to sort by
+// and draws are left in submission order.
+float viewDepth(float x, float y, float z) {
+    float dz = 2.0f - z;
+    return x * x + y * y + dz * dz;
+}
+
+float creatureDepth(const CreatureInstance& c) {
+    return viewDepth(c.x, c.y, 0.0f);
+}
+
+// Maps a float to an unsigned key with the same ordering
+uint32_t depthKey(float depth) {
+    if (depth == 0.0f) return 0x80000000u;  // -0 and +0 are the same depth
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+// Stable LSD radix sort on the 32-bit key, one byte per pass. A pass in
+// which every key has the same byte moves nothing and is skipped, so a list
+// of equal keys costs four counting loops.
+void radixSort(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch) {
+    size_t count = items.size();
+    scratch.resize(count);
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offsets[257] = {};
+        for (const auto& item : items) {
+            ++offsets[((item.key >> shift) & 0xFF) + 1];
+        }
+        bool uniform = false;
+        for (int digit = 0; digit < 256 && !uniform; ++digit) {
+            uniform = offsets[digit + 1] == count;
+        }
+        if (uniform) continue;
+        for (int digit = 0; digit < 256; ++digit) {
+            offsets[digit + 1] += offsets[digit];
+        }
+        for (const auto& item : items) {
+            scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        }
+        items.swap(scratch);
+    }
+}
+
+// Draw order for one opaque category. In perspective it is nearest first so
+// nearer bodies fill the depth buffer before the ones they hide.
+template <typename T, typename Depth>
+const std::vector<DrawItem>& opaqueOrder(const std::vector<T>& instances, Depth depthOf) {
+    opaqueItems.clear();
+    for (size_t i = 0; i < instances.size(); ++i) {
+        uint32_t key = usePerspective ? depthKey(depthOf(instances[i])) : 0;
+        opaqueItems.push_back({ key, (uint32_t)i, DrawKind::Body });
+    }
+    if (usePerspective) radixSort(opaqueItems, sortScratch);
+    return opaqueItems;
+}
+
+RenderPass transparentPass(DrawKind kind) {
+    switch (kind) {
+        case DrawKind::Grass: return RenderPass::Grass;
+        case DrawKind::Seaweed: return RenderPass::Seaweed;
+        case DrawKind::Bubbles: return RenderPass::Bubbles;
+        case DrawKind::Ripples: return RenderPass::Ripples;
+        default: return RenderPass::Fins;
+    }
+}
+
+// Everything with alpha below 1. In perspective it is drawn farthest first
+// so each layer blends over what is behind it; the orthographic view keeps
+// the order below. Depth is tested against the opaque pass but not written,
+// so translucent layers never cut holes in one another. Bubbles and ripples
+// stay single batched draws and sort as one layer each. Each category is
+// timed as its own pass however the sort interleaves them.
+void drawTransparentPass(const RenderSnapshot& snap) {
+    passTimer.begin(RenderPass::Sort);
+    transparentItems.clear();
+    auto add = [](DrawKind kind, size_t index, float depth) {
+        uint32_t key = usePerspective ? ~depthKey(depth) : 0;
+        transparentItems.push_back({ key, (uint32_t)index, kind });
+    };
+    add(DrawKind::Grass, 0, viewDepth(0.0f, -0.8f, 0.0f));
+    for (size_t i = 0; i < snap.seaweeds.size(); ++i) {
+        const Seaweed& seaweed = snap.seaweeds[i];
+        add(DrawKind::Seaweed, i, viewDepth(seaweed.x, -0.8f + seaweed.height * 0.5f, 0.0f));
+    }
+    add(DrawKind::Bubbles, 0, viewDepth(0.0f, 0.0f, 0.0f));
+    add(DrawKind::Ripples, 0, viewDepth(0.0f, 0.0f, 0.0f));
+    for (size_t i = 0; i < snap.fish.size(); ++i) {
+        add(DrawKind::FishFins, i, creatureDepth(snap.fish[i]));
+    }
+    for (size_t i = 0; i < snap.sharks.size(); ++i) {
+        add(DrawKind::SharkFins, i, creatureDepth(snap.sharks[i]));
+    }
+    if (usePerspective) radixSort(transparentItems, sortScratch);
+
+    renderer->setBlending(true);
+    renderer->setDepthWrite(false);
+    passTimer.end(RenderPass::Sort);
+    RenderPass pass = RenderPass::Count;
+    for (const auto& item : transparentItems) {
+        RenderPass next = transparentPass(item.kind);
+        if (next != pass) {
+            if (pass != RenderPass::Count) passTimer.end(pass);
+            passTimer.begin(next);
+            pass = next;
+        }
+        switch (item.kind) {
+            case DrawKind::Grass:
+                drawGrass();
+                break;
+            case DrawKind::Seaweed:
+                drawSeaweed(snap.seaweeds[item.index]);
+                break;
+            case DrawKind::Bubbles:
+                drawBubbles(snap.bubbles);
+                break;
+            case DrawKind::Ripples:
+                drawRipples(snap.ripples);
+                break;
+            case DrawKind::FishFins:
+                drawFishFins(snap.fish[item.index]);
+                break;
+            case DrawKind::SharkFins:
+                drawSharkFins(snap.sharks[item.index]);
+                break;
+            case DrawKind::Body:
+                break;
+        }
+    }
+    if (pass != RenderPass::Count) passTimer.end(pass);
+    renderer->setDepthWrite(true);
+    renderer->setBlending(false);
+}
+
+void renderFrame(const RenderSnapshot& snap) {
+    renderer->beginFrame();
+    if (snap.perspective != usePerspective) {
+        usePerspective = snap.perspective;
+        renderer->setProjection(usePerspective, windowWidth, windowHeight);
+        checkGLError("projection");
+    }
+    FrameTime time = advanceAnimationClock();
+    renderer->setAnimationTime(fmod(time.millis, meshPeriodMs));
+    float t = (float)(time.millis * 0.001);
+    GLfloat lightPos[] = {0.5f * cosf(t), 0.5f * sinf(t), 1.0f, 0.0f};
+    renderer->setLightPosition(0, lightPos);
+    checkGLError("updateLight");
+
+    passTimer.begin(RenderPass::Background);
+    drawBackground(time);
+    passTimer.end(RenderPass::Background);
+
+    // Opaque pass. Blending stays off so the depth test can reject hidden
+    // pixels before they are shaded.
+    renderer->setBlending(false);
+    passTimer.begin(RenderPass::Pebbles);
+    drawPebbles();
+    passTimer.end(RenderPass::Pebbles);
+    passTimer.begin(RenderPass::Crabs);
+    for (const auto& item : opaqueOrder(snap.crabs, creatureDepth)) {
+        drawCrab(snap.crabs[item.index]);
+    }
+    passTimer.end(RenderPass::Crabs);
+    passTimer.begin(RenderPass::Rocks);
+    for (const auto& item : opaqueOrder(snap.rocks, [](const Rock& rock) { return viewDepth(rock.x, -0.85f, 0.0f); })) {
+        const Rock& rock = snap.rocks[item.index];
+        drawRock(rock.x, rock.scale, rock.r, rock.g, rock.b);
+    }
+    passTimer.end(RenderPass::Rocks);
+    passTimer.begin(RenderPass::Fish);
+    for (const auto& item : opaqueOrder(snap.fish, creatureDepth)) {
+        drawFishBody(snap.fish[item.index]);
+    }
+    passTimer.end(RenderPass::Fish);
+    passTimer.begin(RenderPass::Sharks);
+    for (const auto& item : opaqueOrder(snap.sharks, creatureDepth)) {
+        drawSharkBody(snap.sharks[item.index]);
+    }
+    passTimer.end(RenderPass::Sharks);
+    passTimer.begin(RenderPass::Food);
+    renderer->setLighting(false);
+    renderer->setPointSize(3.0f);
+    renderer->color(1.0f, 0.5f, 0.0f, 1.0f);
+    renderer->begin(Primitive::Points);
+    for (const auto& food : snap.food) {
+        renderer->vertex(food.x, food.y);
+    }
+    renderer->end();
+    renderer->setLighting(true);
+    passTimer.end(RenderPass::Food);
+
+    drawTransparentPass(snap);
+    passTimer.endFrame();
+    renderer->endFrame();
+}
+
+void display() {
+    auto start = std::chrono::steady_clock::now();
+    renderFrame(acquireSnapshot());
+    double submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    glutSwapBuffers();
+    checkGLError("display");
+    startup.firstFrame(config.firstFrameTargetMs);
+    updateQualityGovernor(submitMs + passTimer.gpuFrameMs());
+    if (recorder && recorder->frames() % 300 == 0) {
+        recorder->printSummary(std::cout);
+    }
+    if (config.passTiming && passTimer.frameCount() >= 300) {
+        passTimer.report(std::cout);
+    }
+}
+
+void timer(int value) {
+    // Ticks owed at the current time scale, carried between frames
+    static float pendingTicks = 0.0f;
+    if (!config.pipelined && config.connectAddress.empty() && worldReady.load() && !animationClock.paused) {
+        pendingTicks = std::min(pendingTicks + animationClock.scale.load(), 4.0f);
+        while (pendingTicks >= 1.0f) {
+            simulateTick();
+            pendingTicks -= 1.0f;
+        }
+    }
+    glutPostRedisplay();
+    glutTimerFunc(16, timer, 0);
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    if (key == 'r') {
+        queueInput({ InputEvent::Type::Reset, 0.0f, 0.0f });
+    }
+    if (key == 'p') {
+        queueInput({ InputEvent::Type::ToggleProjection, 0.0f, 0.0f });
+    }
+    if (key == ' ') {
+        animationClock.paused = !animationClock.paused;
+        std::cout << (animationClock.paused ? "Paused" : "Resumed") << std::endl;
+    }
+    if (key == '+' || key == '=' || key == '-') {
+        float scale = animationClock.scale * (key == '-' ? 0.5f : 2.0f);
+        animationClock.scale = std::max(0.125f, std::min(8.0f, scale));
+        std::cout << "Time scale " << animationClock.scale << "x" << std::endl;
+    }
+    if (key == 'f') {
+        isFullScreen = !isFullScreen;
+        if (isFullScreen) {
+            glutFullScreen();
+        } else {
+            glutReshapeWindow(900, 600);
+            glutPositionWindow(300, 100);
+        }
+        checkGLError("full screen toggle");
+    }
+    glutPostRedisplay();
+}
+
+void mouse(int button, int state, int x, int y) {
+    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
+        float wx = (2.0f * x / (float)windowWidth) - 1.0f;
+        float wy = 1.0f - (2.0f * y / (float)windowHeight);
+        queueInput({ InputEvent::Type::AddFood, wx, wy });
+    }
+}
+
+// Calls roll(rng, i) for i in [0, count) in chunks of worldgenChunk. Chunk
+// c draws from its own stream seeded with (seed, c), so the result is the
+// same however many threads share the work.
+const int worldgenChunk = 4096;
+
+template <typename Roll>
+void rollInParallel(size_t count, unsigned seed, int threads, Roll roll) {
+    int chunks = (int)((count + worldgenChunk - 1) / worldgenChunk);
+    std::atomic<int> nextChunk{ 0 };
+    auto work = [&] {
+        for (int c = nextChunk++; c < chunks; c = nextChunk++) {
+            std::seed_seq streamSeed = { seed, (unsigned)c };
+            std::minstd_rand rng(streamSeed);
+            size_t end = std::min(count, (size_t)(c + 1) * worldgenChunk);
+            for (size_t i = (size_t)c * worldgenChunk; i < end; ++i) {
+                roll(rng, i);
+            }
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (int t = 1; t < std::min(threads, chunks); ++t) {
+        helpers.emplace_back(work);
+    }
+    work();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+// Builds a fresh tank from the world's seed. `stage`, if given, is called
+// after the scenery and after each species is in, so a caller generating
+// in the background can publish the world as it fills up.
+void initialize(World& world, void (*stage)()) {
+    world.fishes.reset(world.config.fishCount);
+    world.fishes.bounds = { 1.2f, -0.6f, 0.7f };
+    world.sharks.reset(world.config.sharkCount);
+    world.sharks.bounds = { 1.3f, -0.5f, 0.6f };
+    world.eatenFish.clear();
+    world.eatenFish.reserve(world.config.fishCount);
+    world.fishRespawnTicks.clear();
+    world.fishRespawnTicks.reserve(world.config.fishCount);
+    world.bubbleEmitters.clear();
+    world.foodList.clear();
+    world.foodIds.clear();
+    world.nextFoodId = 0;
+    world.rocks.clear();
+    world.seaweeds.clear();
+    initRipples(world, world.config.maxRipples);
+    world.crabs.reset(world.config.crabCount);
+    world.crabs.bounds = { 1.0f, -0.85f, -0.8f };
+
+    // A seeded run must not depend on how many decisions fit in a wall-clock budget
+    double budgetMs = world.config.seed != 0 ? HUGE_VAL : world.config.aiBudgetMs;
+    world.sharkScheduler = { world.config.sharkDecisionInterval, budgetMs };
+    world.fishScheduler = { world.config.fishDecisionInterval, budgetMs };
+
+    // Scenery first, so a tank that streams in while it generates looks
+    // right from the first stage
+    for (int i = 0; i < 5; ++i) {
+        world.rocks.push_back({
+            unitRandom(world.rng) * 2.0f - 1.0f,
+            0.05f + unitRandom(world.rng) * 0.1f,
+            0.4f + unitRandom(world.rng) * 0.2f,
+            0.3f + unitRandom(world.rng) * 0.2f,
+            0.2f + unitRandom(world.rng) * 0.2f
+        });
+    }
+
+    for (int i = 0; i < 12; ++i) {
+        world.seaweeds.push_back({
+            unitRandom(world.rng) * 2.0f - 1.0f,
+            0.2f + unitRandom(world.rng) * 0.2f,
+            0.4f + unitRandom(world.rng) * 0.3f
+        });
+    }
+
+    bakeFlowField(world);
+
+    world.bubbleEmitters.push_back({ 0.0f, -1.0f, 1.0f, world.config.ambientBubbleRate, 0.0f });
+    for (const auto& sw : world.seaweeds) {
+        world.bubbleEmitters.push_back({ sw.x, -0.8f + sw.height, 0.01f, world.config.seaweedBubbleRate, 0.0f });
+    }
+
+    initBubblePool(world, world.config.bubbleCapacity);
+    for (int i = 0; i < world.config.initialBubbles; ++i) {
+        spawnBubble(world, unitRandom(world.rng) * 2.0f - 1.0f,
+                    unitRandom(world.rng) * 2.0f - 1.0f);
+    }
+    if (stage) stage();
+
+    // Creatures are rolled straight into their rows on worker threads, each
+    // species from its own seed
+    int threads = worldgenThreadCount(world.config);
+    unsigned fishSeed = world.rng(), sharkSeed = world.rng(), crabSeed = world.rng();
+
+    size_t first = world.fishes.spawnRows(world.config.fishCount);
+    auto& fishMotion = column<Motion>(world.fishes);
+    auto& fishLook = column<Appearance>(world.fishes);
+    auto& schooling = column<Schooling>(world.fishes);
+    const AIScheduler& fishScheduler = world.fishScheduler;
+    rollInParallel(world.fishes.size() - first, fishSeed, threads, [&](std::minstd_rand& rng, size_t i) {
+        rollFish(rng, fishMotion[first + i], fishLook[first + i]);
+        schooling[first + i].nextDecision = staggeredDecisionTick(rng, fishScheduler);
+    });
+    if (stage) stage();
+
+    first = world.sharks.spawnRows(world.config.sharkCount);
+    auto& sharkMotion = column<Motion>(world.sharks);
+    auto& sharkLook = column<Appearance>(world.sharks);
+    auto& hunters = column<Predator>(world.sharks);
+    const AIScheduler& sharkScheduler = world.sharkScheduler;
+    rollInParallel(world.sharks.size() - first, sharkSeed, threads, [&](std::minstd_rand& rng, size_t i) {
+        bool right = rng() % 2 == 0;
+        sharkMotion[first + i] = {
+            unitRandom(rng) * 2.0f - 1.0f,
+            unitRandom(rng) * 1.0f - 0.5f,
+            (0.002f + unitRandom(rng) * 0.004f) * 0.5f,
+            right ? 0.0f : 3.1416f,
+            right
+        };
+        sharkLook[first + i] = {
+            0.2f + unitRandom(rng) * 0.15f,
+            0.4f + unitRandom(rng) * 0.1f,
+            0.4f + unitRandom(rng) * 0.1f,
+            0.4f + unitRandom(rng) * 0.1f
+        };
+        Predator& hunter = hunters[first + i];
+        hunter.hunger = unitRandom(rng);
+        hunter.state = PredatorState::Patrol;
+        hunter.stateTimer = 5.0f + unitRandom(rng) * 5.0f;
+        hunter.nextDecision = staggeredDecisionTick(rng, sharkScheduler);
+    });
+    if (stage) stage();
+
+    first = world.crabs.spawnRows(world.config.crabCount);
+    auto& crabMotion = column<Motion>(world.crabs);
+    auto& crabLook = column<Appearance>(world.crabs);
+    rollInParallel(world.crabs.size() - first, crabSeed, threads, [&](std::minstd_rand& rng, size_t i) {
+        bool right = rng() % 2 == 0;
+        float speed = right ? (0.002f + unitRandom(rng) * 0.002f) : -(0.002f + unitRandom(rng) * 0.002f);
+        crabMotion[first + i] = { unitRandom(rng) * 2.0f - 1.0f, -0.83f, speed, 0.0f, right };
+        crabLook[first + i] = {
+            0.06f + unitRandom(rng) * 0.02f,
+            0.9f + unitRandom(rng) * 0.1f,
+            0.2f + unitRandom(rng) * 0.1f,
+            0.1f + unitRandom(rng) * 0.1f
+        };
+    });
+    if (world.verbose) {
+        for (size_t i = first; i < world.crabs.size(); ++i) {
+            const Motion& m = crabMotion[i];
+            std::cout << "Initialized crab " << i << " at x=" << m.x << ", y=" << m.y << ", speed=" << m.speed << std::endl;
+        }
+    }
+    if (stage) stage();
+}
+
+// Parses "--name=value" style overrides for the Config tunables
+bool parseOption(const char* arg, const char* name, const char** value) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+    *value = arg + len + 1;
+    return true;
+}
+
+// Applies one option to a configuration; false if the option is unknown.
+// Batch sweeps reuse this, so any option can be swept.
+bool applyOption(Config& settings, const char* arg) {
+    const char* value = nullptr;
+    if (parseOption(arg, "--bubble-capacity", &value)) {
+        settings.bubbleCapacity = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--initial-bubbles", &value)) {
+        settings.initialBubbles = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--ambient-bubble-rate", &value)) {
+        settings.ambientBubbleRate = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--seaweed-bubble-rate", &value)) {
+        settings.seaweedBubbleRate = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--chase-bubble-burst", &value)) {
+        settings.chaseBubbleBurst = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--max-ripples", &value)) {
+        settings.maxRipples = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--fish-count", &value)) {
+        settings.fishCount = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--shark-count", &value)) {
+        settings.sharkCount = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--crab-count", &value)) {
+        settings.crabCount = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--fish-respawn-seconds", &value)) {
+        settings.fishRespawnSeconds = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--shark-hunger-rate", &value)) {
+        settings.sharkHungerRate = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--flee-radius", &value)) {
+        settings.fleeRadius = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--eat-radius", &value)) {
+        settings.eatRadius = std::max(0.0f, (float)atof(value));
+    } else if (parseOption(arg, "--shark-decision-interval", &value)) {
+        settings.sharkDecisionInterval = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--fish-decision-interval", &value)) {
+        settings.fishDecisionInterval = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--ai-budget-ms", &value)) {
+        settings.aiBudgetMs = std::max(0.0, atof(value));
+    } else if (parseOption(arg, "--quality", &value)) {
+        for (int tier = 0; tier < qualityTierCount; ++tier) {
+            if (strcmp(value, qualityTiers[tier].name) == 0) settings.qualityTier = tier;
+        }
+    } else if (parseOption(arg, "--target-frame-ms", &value)) {
+        settings.targetFrameMs = std::max(0.0, atof(value));
+    } else if (parseOption(arg, "--time-scale", &value)) {
+        settings.timeScale = std::max(0.05f, (float)atof(value));
+    } else if (parseOption(arg, "--fixed-step-ms", &value)) {
+        settings.fixedStepMs = std::max(0.0, atof(value));
+    } else if (parseOption(arg, "--seed", &value)) {
+        settings.seed = (unsigned)strtoul(value, nullptr, 10);
+    } else if (parseOption(arg, "--record-input", &value)) {
+        settings.recordInputPath = value;
+    } else if (parseOption(arg, "--replay-input", &value)) {
+        settings.replayInputPath = value;
+    } else if (parseOption(arg, "--trajectory", &value)) {
+        settings.trajectoryPath = value;
+    } else if (parseOption(arg, "--trajectory-every", &value)) {
+        settings.trajectoryEvery = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--trajectory-buffer-mb", &value)) {
+        settings.trajectoryBufferMb = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--renderer", &value)) {
+        settings.renderer = value;
+    } else if (strcmp(arg, "--record") == 0) {
+        settings.recordStats = true;
+    } else if (parseOption(arg, "--command-dump", &value)) {
+        settings.commandDump = value;
+    } else if (parseOption(arg, "--dump-frames", &value)) {
+        settings.dumpFrames = std::max(0, atoi(value));
+    } else if (strcmp(arg, "--headless") == 0) {
+        settings.headless = true;
+    } else if (parseOption(arg, "--frames", &value)) {
+        settings.frames = std::max(1, atoi(value));
+    } else if (strcmp(arg, "--pass-timing") == 0) {
+        settings.passTiming = true;
+    } else if (strcmp(arg, "--no-pipeline") == 0) {
+        settings.pipelined = false;
+    } else if (strcmp(arg, "--batch") == 0) {
+        settings.batch = true;
+    } else if (parseOption(arg, "--sweep", &value)) {
+        settings.sweeps.push_back(value);
+    } else if (parseOption(arg, "--batch-seeds", &value)) {
+        settings.batchSeeds = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--batch-ticks", &value)) {
+        settings.batchTicks = std::max(1, atoi(value));
+    } else if (parseOption(arg, "--batch-threads", &value)) {
+        settings.batchThreads = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--worldgen-threads", &value)) {
+        settings.worldgenThreads = std::max(0, atoi(value));
+    } else if (parseOption(arg, "--first-frame-target-ms", &value)) {
+        settings.firstFrameTargetMs = std::max(0.0, atof(value));
+    } else if (parseOption(arg, "--serve", &value)) {
+        settings.serveAddress = value;
+    } else if (parseOption(arg, "--connect", &value)) {
+        settings.connectAddress = value;
+    } else if (parseOption(arg, "--serve-ticks", &value)) {
+        settings.serveTicks = std::max(0, atoi(value));
+    } else if (strcmp(arg, "--verbose") == 0) {
+        settings.verbose = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!applyOption(config, argv[i])) {
+            std::cerr << "Ignoring unknown option " << argv[i] << std::endl;
+        }
+    }
+}
+
+// Runs simulation and scene submission back to back without a window, or
+// with --connect draws each frame received from a server.
+// Only the null and recording backends can be used here.
+int runHeadless() {
+    if (config.renderer == "auto") {
+        config.renderer = "record";
+    }
+    if (config.renderer != "null" && config.renderer != "record") {
+        std::cerr << "Headless mode needs --renderer=null or --renderer=record" << std::endl;
+        return -1;
+    }
+    config.pipelined = false;
+    // Offline runs animate deterministically unless told otherwise
+    if (animationClock.fixedStepMillis <= 0.0) {
+        animationClock.fixedStepMillis = 16.0;
+    }
+    buildMeshes();
+    startup.phase("meshes");
+    renderer = createRenderer();
+    initGL();
+    passTimer.init(config.passTiming, false);
+    initBubbleTexture();
+    startup.phase("renderer");
+    bool client = !config.connectAddress.empty();
+    if (client) {
+        if (!netClient.connect(config.connectAddress)) return -1;
+    } else {
+        seedSimulation();
+        generateWorld(nullptr);
+        startup.phase("world");
+        openTrajectory();
+    }
+    publishSnapshot();
+
+    double simMs = 0.0, renderMs = 0.0;
+    int frames = 0;
+    for (; frames < config.frames; ++frames) {
+        auto start = std::chrono::steady_clock::now();
+        if (client) {
+            if (!netClient.receiveFrame()) break;
+        } else {
+            simulateTick();
+        }
+        auto simulated = std::chrono::steady_clock::now();
+        renderFrame(acquireSnapshot());
+        startup.firstFrame(config.firstFrameTargetMs);
+        auto rendered = std::chrono::steady_clock::now();
+        simMs += std::chrono::duration<double, std::milli>(simulated - start).count();
+        renderMs += std::chrono::duration<double, std::milli>(rendered - simulated).count();
+    }
+    int measured = std::max(frames, 1);
+    std::cout << "Headless run: " << frames << " frames on the " << renderer->name() << " renderer, "
+              << simMs / measured << (client ? " ms receiving and " : " ms simulation and ")
+              << renderMs / measured << " ms submission per frame" << std::endl;
+    if (recorder) {
+        recorder->printSummary(std::cout);
+    }
+    passTimer.report(std::cout);
+    if (client) {
+        netClient.printSummary(std::cout);
+        netClient.stop();
+        return 0;
+    }
+    std::cout << "Predation broadphase: " << (double)tank.predationBroadphase.candidates / measured
+              << " predator-prey pairs tested per tick" << std::endl;
+    if (inputJournal.replaying) {
+        std::cout << "Input journal: " << inputJournal.next << " of " << inputJournal.replay.size()
+                  << " inputs replayed" << std::endl;
+    }
+    std::cout << "State checksum after tick " << tank.tick << ": " << std::hex << simulationChecksum(tank)
+              << std::dec << std::endl;
+    trajectory.close();
+    closeInputJournal();
+    return 0;
+}
+
+// Runs the simulation without a window and streams it to --connect clients
+// at the normal tick rate. The stream is ordered and lossless, so each
+// client gets a delta against the last frame queued for it, which is what it
+// will hold when this one arrives, or a keyframe once that tick has left the
+// history. A client too far behind to take more has frames skipped; the
+// next one it does get is still based on what it holds.
+int runServer() {
+    if (!netStartup()) {
+        std::cerr << "Cannot start networking" << std::endl;
+        return -1;
+    }
+    NetSocket listener = openNetSocket(config.serveAddress, true);
+    if (listener == invalidSocket) {
+        std::cerr << "Cannot listen on " << config.serveAddress << std::endl;
+        return -1;
+    }
+    setNonBlocking(listener);
+    seedSimulation();
+    initialize(tank);
+    openTrajectory();
+    std::cout << "Serving on " << config.serveAddress << std::endl;
+
+    struct ServerClient {
+        NetConnection connection;
+        long sent = -1;     // tick of the last frame queued for the client
+    };
+    std::vector<std::unique_ptr<ServerClient>> clients;
+    std::vector<NetSnapshot> history(netHistory);
+    std::vector<uint8_t> frame;
+    NetDeltaStats delta;
+    long frames = 0, keyframes = 0, skipped = 0, frameBytes = 0;
+
+    auto tickLength = std::chrono::duration<double, std::milli>(16.0 / config.timeScale);
+    auto nextTick = std::chrono::steady_clock::now();
+    for (long served = 0; config.serveTicks == 0 || served < config.serveTicks; ++served) {
+        NetSocket accepted;
+        while ((accepted = accept(listener, nullptr, nullptr)) != invalidSocket) {
+            setNonBlocking(accepted);
+            setNoDelay(accepted);
+            clients.emplace_back(new ServerClient);
+            NetConnection& connection = clients.back()->connection;
+            connection.socket = accepted;
+            connection.open = true;
+            connection.outbox.assign(netGreeting, netGreeting + sizeof(netGreeting));
+            std::cout << "Client connected at tick " << tank.tick << "; " << clients.size() << " connected" << std::endl;
+        }
+        for (auto& client : clients) {
+            NetConnection& connection = client->connection;
+            connection.receive();
+            NetMessage type;
+            const uint8_t* payload;
+            size_t size;
+            while (connection.next(type, payload, size)) {
+                NetReader in(payload, size);
+                if (type == NetMessage::Input) {
+                    InputEvent e;
+                    e.type = (InputEvent::Type)std::min<uint8_t>(in.byte(), (uint8_t)InputEvent::Type::ToggleProjection);
+                    e.x = in.f32();
+                    e.y = in.f32();
+                    if (in.ok) queueInput(e);
+                }
+            }
+        }
+        size_t before = clients.size();
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+            [](const std::unique_ptr<ServerClient>& c) { return !c->connection.open; }), clients.end());
+        if (clients.size() != before) {
+            std::cout << "Client disconnected at tick " << tank.tick << "; " << clients.size() << " connected" << std::endl;
+        }
+
+        applyInput();
+        stepWorld(tank);
+        if (trajectory.isOpen()) {
+            trajectory.record(tank);
+        }
+        NetSnapshot& snap = history[tank.tick % netHistory];
+        captureNetSnapshot(tank, perspectiveView, snap);
+
+        for (auto& client : clients) {
+            NetConnection& connection = client->connection;
+            if (connection.outbox.size() > netOutboxLimit) {
+                ++skipped;
+                continue;
+            }
+            const NetSnapshot* base = nullptr;
+            if (client->sent >= 0 && tank.tick - client->sent < netHistory &&
+                history[client->sent % netHistory].tick == client->sent) {
+                base = &history[client->sent % netHistory];
+            }
+            encodeNetFrame(base, snap, frame, delta);
+            connection.queue(NetMessage::Frame, frame.data(), frame.size());
+            connection.flush();
+            client->sent = tank.tick;
+            ++frames;
+            if (!base) ++keyframes;
+            frameBytes += (long)frame.size();
+        }
+
+        if (tank.tick % 300 == 0 && frames > 0) {
+            std::cout << "Tick " << tank.tick << ": " << clients.size() << " clients, "
+                      << (double)frameBytes / frames << " bytes per frame, "
+                      << (double)delta.changed / frames << " of " << (double)delta.records / frames
+                      << " records sent, " << keyframes << " keyframes, " << skipped << " frames skipped" << std::endl;
+            frames = keyframes = skipped = frameBytes = 0;
+            delta = NetDeltaStats();
+        }
+
+        nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(tickLength);
+        std::this_thread::sleep_until(nextTick);
+    }
+
+    // Give slow clients a moment to drain before closing on them
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    for (auto& client : clients) {
+        while (!client->connection.outbox.empty() && client->connection.flush() &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        client->connection.close();
+    }
+    closeSocket(listener);
+#ifndef _WIN32
+    if (config.serveAddress.compare(0, 5, "unix:") == 0) {
+        unlink(config.serveAddress.c_str() + 5);
+    }
+#endif
+    std::cout << "Served " << config.serveTicks << " ticks; last tick " << tank.tick << " snapshot hash "
+              << std::hex << netSnapshotHash(history[tank.tick % netHistory]) << std::dec << std::endl;
+    trajectory.close();
+    closeInputJournal();
+    return 0;
+}
+
+// One batch world: the sweep values that set it apart and how it ended
+struct BatchWorld {
+    Config settings;
+    std::vector<std::string> sweepValues;
+    int survivors = 0;           // fish alive after the last tick
+    long fishEaten = 0;
+    double meanHunger = 0.0;     // shark hunger averaged over every tick
+    double ticksPerSecond = 0.0;
+};
+
+// Every combination of the --sweep values, each with --batch-seeds
+// consecutive seeds. Points share seeds so they differ only in the sweep.
+bool buildBatch(std::vector<std::string>& sweepNames, std::vector<BatchWorld>& worlds) {
+    std::vector<std::vector<std::string>> points(1);
+    for (const auto& sweep : config.sweeps) {
+        size_t equals = sweep.find('=');
+        if (equals == std::string::npos) {
+            std::cerr << "--sweep needs option=value,value,... but got " << sweep << std::endl;
+            return false;
+        }
+        sweepNames.push_back(sweep.substr(0, equals));
+        std::vector<std::vector<std::string>> expanded;
+        size_t start = equals + 1;
+        while (start <= sweep.size()) {
+            size_t comma = std::min(sweep.find(',', start), sweep.size());
+            for (const auto& point : points) {
+                expanded.push_back(point);
+                expanded.back().push_back(sweep.substr(start, comma - start));
+            }
+            start = comma + 1;
+        }
+        points.swap(expanded);
+    }
+
+    unsigned firstSeed = config.seed != 0 ? config.seed : 1;
+    for (const auto& point : points) {
+        BatchWorld base;
+        base.settings = config;
+        base.sweepValues = point;
+        for (size_t n = 0; n < point.size(); ++n) {
+            std::string option = "--" + sweepNames[n] + "=" + point[n];
+            if (!applyOption(base.settings, option.c_str())) {
+                std::cerr << "Cannot sweep " << option << std::endl;
+                return false;
+            }
+        }
+        for (int k = 0; k < config.batchSeeds; ++k) {
+            worlds.push_back(base);
+            worlds.back().settings.seed = firstSeed + k;
+        }
+    }
+    return true;
+}
+
+void runBatchWorld(BatchWorld& result) {
+    World world;
+    world.config = result.settings;
+    world.config.worldgenThreads = 1;   // the batch already keeps every thread busy
+    world.verbose = false;
+    world.rng.seed(result.settings.seed);
+    initialize(world);
+
+    double hungerTotal = 0.0;
+    long hungerSamples = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < result.settings.batchTicks; ++tick) {
+        stepWorld(world);
+        for (const auto& p : column<Predator>(world.sharks)) {
+            hungerTotal += p.hunger;
+        }
+        hungerSamples += (long)world.sharks.size();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    result.survivors = (int)world.fishes.size();
+    result.fishEaten = world.fishEaten;
+    result.meanHunger = hungerSamples > 0 ? hungerTotal / hungerSamples : 0.0;
+    result.ticksPerSecond = seconds > 0.0 ? result.settings.batchTicks / seconds : 0.0;
+}
+
+// Steps every world of a parameter sweep to completion on a pool of worker
+// threads, then prints one CSV row per world. Worlds share nothing, so each
+// worker just takes the next unstarted world until none are left.
+int runBatch() {
+    std::vector<std::string> sweepNames;
+    std::vector<BatchWorld> worlds;
+    if (!buildBatch(sweepNames, worlds)) {
+        return -1;
+    }
+    int threadCount = config.batchThreads > 0 ? config.batchThreads : (int)std::thread::hardware_concurrency();
+    threadCount = std::max(1, std::min(threadCount, (int)worlds.size()));
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> nextWorld{ 0 };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threadCount; ++t) {
+        pool.emplace_back([&worlds, &nextWorld] {
+            for (size_t i = nextWorld++; i < worlds.size(); i = nextWorld++) {
+                runBatchWorld(worlds[i]);
+            }
+        });
+    }
+    for (auto& worker : pool) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "world,seed";
+    for (const auto& name : sweepNames) std::cout << "," << name;
+    std::cout << ",survivors,fish_eaten,mean_shark_hunger,ticks_per_second" << std::endl;
+    for (size_t i = 0; i < worlds.size(); ++i) {
+        const BatchWorld& w = worlds[i];
+        std::cout << i << "," << w.settings.seed;
+        for (const auto& value : w.sweepValues) std::cout << "," << value;
+        std::cout << "," << w.survivors << "," << w.fishEaten << "," << w.meanHunger << "," << w.ticksPerSecond << std::endl;
+    }
+    std::cerr << "Batch: " << worlds.size() << " worlds of " << config.batchTicks << " ticks in " << seconds
+              << " s on " << threadCount << (threadCount == 1 ? " thread, " : " threads, ")
+              << worlds.size() * (double)config.batchTicks / seconds << " ticks/s overall" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    parseArgs(argc, argv);
+    governor.tier = config.qualityTier;
+    animationClock.scale = config.timeScale;
+    animationClock.fixedStepMillis = config.fixedStepMs;
+    if (config.batch) {
+        return runBatch();
+    }
+    if (!config.serveAddress.empty()) {
+        return runServer();
+    }
+    if (config.headless) {
+        return runHeadless();
+    }
+    bool client = !config.connectAddress.empty();
+    if (!client) {
+        // The tank generates while the window and meshes are set up, and
+        // shows up stage by stage once frames are being drawn
+        config.verbose = true;
+        seedSimulation();
+        startWorldGeneration();
+        atexit(finishWorldGeneration);
+    }
+    glutInit(&argc, argv);
+    if (config.renderer == "core") {
+        glutInitContextVersion(3, 3);
+        glutInitContextProfile(GLUT_CORE_PROFILE);
+    }
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+    glutInitWindowSize(windowWidth, windowHeight);
+    glutInitWindowPosition(300, 100);
+    int window = glutCreateWindow("Interactive Underwater World");
+    if (window == 0) {
+        std::cerr << "Failed to create GLUT window" << std::endl;
+        return -1;
+    }
+    haveGLContext = true;
+    startup.phase("context");
+
+    buildMeshes();
+    startup.phase("meshes");
+    renderer = createRenderer();
+    if (!renderer) {
+        std::cerr << "No usable renderer backend" << std::endl;
+        return -1;
+    }
+    std::cout << "Using " << renderer->name() << " renderer" << std::endl;
+    initGL();
+    // The null and recording backends submit nothing, so there is no GPU work
+    // to time. The quality governor reads the timings even when they are not
+    // reported.
+    passTimer.init(config.passTiming || config.targetFrameMs > 0.0,
+                   config.renderer != "null" && config.renderer != "record");
+    initBubbleTexture();
+    startup.phase("renderer");
+    if (client) {
+        // The server simulates; this process only draws what it sends
+        if (!netClient.connect(config.connectAddress)) return -1;
+        publishSnapshot();
+        netClient.start();
+        atexit(stopNetClient);
+    } else {
+        openTrajectory();
+        // atexit runs in reverse, so the simulation thread stops before the files are closed
+        atexit(closeTrajectory);
+        atexit(closeInputJournal);
+        if (config.pipelined) {
+            startSimulationThread();
+            atexit(stopSimulationThread);
+        }
+    }
+
+    glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
+    glutTimerFunc(0, timer, 0);
+    glutKeyboardFunc(keyboard);
+    glutMouseFunc(mouse);
+
+    glutMainLoop();
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdint>
+
+// On-disk layout shared by the recorder in main.cpp and trajectory_reader.
+//
+// A file is a TrajectoryFileHeader followed by one block per recorded tick.
+// Each block is a TrajectoryTickHeader and then its columns, one array per
+// field, in this order:
+//   fish:   slot[u32] generation[u32] x[f32] y[f32] angle[f32] speed[f32]
+//   sharks: slot[u32] generation[u32] x[f32] y[f32] hunger[f32] state[u8]
+// The shark state column is padded with zeros to a multiple of 4 bytes so
+// every column starts 4-byte aligned. Values are in host byte order.
+
+const char trajectoryMagic[8] = { 'U', 'W', 'T', 'R', 'A', 'J', '\0', '\0' };
+const uint32_t trajectoryVersion = 1;
+
+struct TrajectoryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;       // sizeof(TrajectoryFileHeader)
+};
+
+struct TrajectoryTickHeader {
+    int64_t tick;
+    uint32_t fishCount;
+    uint32_t sharkCount;
+    uint32_t foodCount;
+    uint32_t payloadBytes;      // bytes of column data after this header
+};
+
+inline uint32_t trajectoryPayloadBytes(uint32_t fishCount, uint32_t sharkCount) {
+    uint32_t stateBytes = (sharkCount + 3) & ~3u;
+    return fishCount * 6 * 4 + sharkCount * 5 * 4 + stateBytes;
+}
+
+#endif
@@ -0,0 +1,243 @@
+// Reads trajectory files written by the simulation's --trajectory option.
+// The file is memory-mapped, so even long recordings open instantly and only
+// the ticks that are looked at are paged in.
+//
+//   trajectory_reader FILE             summary of the whole recording
+//   trajectory_reader FILE --tick=N    every entity at tick N as CSV
+//   trajectory_reader FILE --fish=S    the path of the fish in slot S as CSV
+
+#include "trajectory.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    bool open(const char* path) {
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) return false;
+        size = (size_t)length.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        data = view == MAP_FAILED ? nullptr : (const unsigned char*)view;
+#endif
+        return data != nullptr;
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap((void*)data, size);
+#endif
+    }
+};
+
+// Column views into one tick block
+struct TickView {
+    TrajectoryTickHeader header;
+    const unsigned char* fishSlot;
+    const unsigned char* fishGeneration;
+    const unsigned char* fishX;
+    const unsigned char* fishY;
+    const unsigned char* fishAngle;
+    const unsigned char* fishSpeed;
+    const unsigned char* sharkSlot;
+    const unsigned char* sharkGeneration;
+    const unsigned char* sharkX;
+    const unsigned char* sharkY;
+    const unsigned char* sharkHunger;
+    const unsigned char* sharkState;
+};
+
+template <typename T>
+T readAt(const unsigned char* column, size_t i) {
+    T value;
+    memcpy(&value, column + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+// Walks the blocks of a mapped recording in order
+struct TickCursor {
+    const MappedFile& file;
+    size_t offset;
+
+    explicit TickCursor(const MappedFile& file) : file(file), offset(sizeof(TrajectoryFileHeader)) {}
+
+    bool next(TickView& view) {
+        if (offset + sizeof(TrajectoryTickHeader) > file.size) return false;
+        memcpy(&view.header, file.data + offset, sizeof(TrajectoryTickHeader));
+        const TrajectoryTickHeader& h = view.header;
+        size_t end = offset + sizeof(TrajectoryTickHeader) + h.payloadBytes;
+        if (h.payloadBytes != trajectoryPayloadBytes(h.fishCount, h.sharkCount) || end > file.size) {
+            fprintf(stderr, "Truncated or corrupt block at byte %zu\n", offset);
+            return false;
+        }
+        const unsigned char* p = file.data + offset + sizeof(TrajectoryTickHeader);
+        const unsigned char** fishColumns[] = { &view.fishSlot, &view.fishGeneration, &view.fishX,
+                                                &view.fishY, &view.fishAngle, &view.fishSpeed };
+        for (auto column : fishColumns) {
+            *column = p;
+            p += h.fishCount * 4;
+        }
+        const unsigned char** sharkColumns[] = { &view.sharkSlot, &view.sharkGeneration, &view.sharkX,
+                                                 &view.sharkY, &view.sharkHunger };
+        for (auto column : sharkColumns) {
+            *column = p;
+            p += h.sharkCount * 4;
+        }
+        view.sharkState = p;
+        offset = end;
+        return true;
+    }
+};
+
+const char* stateNames[] = { "idle", "patrol", "chase", "rest" };
+
+void printSummary(const MappedFile& file) {
+    TickCursor cursor(file);
+    TickView view;
+    long ticks = 0;
+    int64_t firstTick = 0, lastTick = 0;
+    uint32_t minFish = UINT32_MAX, maxFish = 0;
+    double fishTotal = 0.0, foodTotal = 0.0, speedTotal = 0.0, hungerTotal = 0.0;
+    double fishSamples = 0.0, sharkSamples = 0.0;
+    long states[4] = {};
+    while (cursor.next(view)) {
+        const TrajectoryTickHeader& h = view.header;
+        if (ticks == 0) firstTick = h.tick;
+        lastTick = h.tick;
+        ++ticks;
+        minFish = std::min(minFish, h.fishCount);
+        maxFish = std::max(maxFish, h.fishCount);
+        fishTotal += h.fishCount;
+        foodTotal += h.foodCount;
+        for (uint32_t i = 0; i < h.fishCount; ++i) {
+            speedTotal += readAt<float>(view.fishSpeed, i);
+        }
+        fishSamples += h.fishCount;
+        for (uint32_t i = 0; i < h.sharkCount; ++i) {
+            hungerTotal += readAt<float>(view.sharkHunger, i);
+            ++states[std::min<unsigned>(view.sharkState[i], 3)];
+        }
+        sharkSamples += h.sharkCount;
+    }
+    if (ticks == 0) {
+        printf("No ticks recorded\n");
+        return;
+    }
+    printf("%ld ticks recorded, ticks %lld to %lld\n", ticks, (long long)firstTick, (long long)lastTick);
+    printf("fish per tick: min %u, max %u, mean %.1f\n", minFish, maxFish, fishTotal / ticks);
+    printf("food per tick: mean %.2f\n", foodTotal / ticks);
+    printf("mean fish speed: %.5f\n", fishSamples > 0 ? speedTotal / fishSamples : 0.0);
+    printf("mean shark hunger: %.3f\n", sharkSamples > 0 ? hungerTotal / sharkSamples : 0.0);
+    for (int s = 0; s < 4; ++s) {
+        printf("shark %-6s %5.1f%%\n", stateNames[s], sharkSamples > 0 ? 100.0 * states[s] / sharkSamples : 0.0);
+    }
+}
+
+void printTick(const MappedFile& file, long tick) {
+    TickCursor cursor(file);
+    TickView view;
+    while (cursor.next(view)) {
+        if (view.header.tick != tick) continue;
+        printf("kind,slot,generation,x,y,angle,speed,hunger,state\n");
+        for (uint32_t i = 0; i < view.header.fishCount; ++i) {
+            printf("fish,%u,%u,%f,%f,%f,%f,,\n", readAt<uint32_t>(view.fishSlot, i),
+                   readAt<uint32_t>(view.fishGeneration, i), readAt<float>(view.fishX, i),
+                   readAt<float>(view.fishY, i), readAt<float>(view.fishAngle, i), readAt<float>(view.fishSpeed, i));
+        }
+        for (uint32_t i = 0; i < view.header.sharkCount; ++i) {
+            printf("shark,%u,%u,%f,%f,,,%f,%s\n", readAt<uint32_t>(view.sharkSlot, i),
+                   readAt<uint32_t>(view.sharkGeneration, i), readAt<float>(view.sharkX, i),
+                   readAt<float>(view.sharkY, i), readAt<float>(view.sharkHunger, i),
+                   stateNames[std::min<unsigned>(view.sharkState[i], 3)]);
+        }
+        return;
+    }
+    fprintf(stderr, "Tick %ld was not recorded\n", tick);
+}
+
+void printFishTrack(const MappedFile& file, uint32_t slot) {
+    TickCursor cursor(file);
+    TickView view;
+    printf("tick,generation,x,y,angle,speed\n");
+    while (cursor.next(view)) {
+        for (uint32_t i = 0; i < view.header.fishCount; ++i) {
+            if (readAt<uint32_t>(view.fishSlot, i) != slot) continue;
+            printf("%lld,%u,%f,%f,%f,%f\n", (long long)view.header.tick, readAt<uint32_t>(view.fishGeneration, i),
+                   readAt<float>(view.fishX, i), readAt<float>(view.fishY, i),
+                   readAt<float>(view.fishAngle, i), readAt<float>(view.fishSpeed, i));
+            break;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [--tick=N | --fish=SLOT]\n", argv[0]);
+        return 1;
+    }
+    MappedFile file;
+    if (!file.open(argv[1])) {
+        fprintf(stderr, "Cannot map %s\n", argv[1]);
+        return 1;
+    }
+    TrajectoryFileHeader header;
+    if (file.size < sizeof(header)) {
+        fprintf(stderr, "%s is not a trajectory file\n", argv[1]);
+        return 1;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, trajectoryMagic, sizeof(trajectoryMagic)) != 0) {
+        fprintf(stderr, "%s is not a trajectory file\n", argv[1]);
+        return 1;
+    }
+    if (header.version != trajectoryVersion || header.headerBytes != sizeof(header)) {
+        fprintf(stderr, "Unsupported trajectory version %u\n", header.version);
+        return 1;
+    }
+
+    if (argc > 2 && strncmp(argv[2], "--tick=", 7) == 0) {
+        printTick(file, atol(argv[2] + 7));
+    } else if (argc > 2 && strncmp(argv[2], "--fish=", 7) == 0) {
+        printFishTrack(file, (uint32_t)strtoul(argv[2] + 7, nullptr, 10));
+    } else {
+        printSummary(file);
+    }
+    return 0;
+}